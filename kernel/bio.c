@@ -1,10 +1,16 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// The cache starts with NBUF buffers and grows, a buffer per
+// miss, up to 1/BCACHEFRAC of memory; when kalloc() runs out
+// of pages, breclaim() frees unused buffers back down to NBUF.
+// Once it's full, a replacement policy picks the buffer a miss
+// recycles: 2Q, or with BCLOCK defined, a plain clock.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -16,76 +22,471 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
+
+// the number of hash buckets; prime, so that blocks a fixed
+// stride apart spread over all of them.
+#define NBUCKET 251
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// buffers breclaim() frees per call.
+#define NRECLAIM 32
+
+// Each bucket holds the buffers whose blocks hash to it, on a
+// list through hnext, under the bucket's own lock, so that
+// lookups of different blocks proceed in parallel. A buffer's
+// refcnt, used bit and place in a bucket are protected by that
+// lock. Every buffer is in some bucket; one that has never held
+// a block is in block 0 of device 0's.
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;
+  uint nhit;     // lookups that found their block here
+};
+
+// A replacement policy decides which buffer a miss recycles.
+// Its calls are made holding bcache.lock.
+struct bpolicy {
+  char *name;
+  void (*init)(void);
+  // b, new or recycled, now holds the block a miss asked for.
+  void (*add)(struct buf *b);
+  // choose an unused buffer, and take it out of the cache with
+  // btake(). bk, if not 0, is the bucket the caller has locked.
+  // returns 0 if every buffer is in use.
+  struct buf *(*victim)(struct bucket *bk);
+  void (*dump)(void);
+};
 
 struct {
+  // held while a miss adds or recycles a buffer, which moves
+  // it from one bucket to another; it keeps two misses for
+  // the same block from both loading it, and only its holder
+  // ever holds two bucket locks at once. it also protects
+  // the policy's lists.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct kmem_cache *cache;
+  struct bpolicy *policy;
+  int nbuf;
+  int maxbuf;   // the most buffers the cache may grow to
+  uint nmiss;
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  int nbusy;    // number of buffers with refcnt > 0
 } bcache;
 
+static void
+bufctor(void *p)
+{
+  initsleeplock(&((struct buf*)p)->lock, "buffer");
+}
+
+// Put b on bucket bk's list. Caller must hold bk->lock.
+static void
+hashinsert(struct bucket *bk, struct buf *b)
+{
+  b->hnext = bk->head;
+  bk->head = b;
+}
+
+// Take b off bucket bk's list. Caller must hold bk->lock.
+static void
+hashremove(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+// Take b, a policy's candidate, out of its bucket if no one is
+// using it, nor reading it ahead. If clock is set, b must also not have been released
+// since the last look; its used bit is cleared either way.
+// Caller must hold bcache.lock, and bk's lock if bk is not 0.
+// Returns 1 if b was taken.
+static int
+btake(struct buf *b, struct bucket *bk, int clock)
+{
+  struct bucket *vbk;
+  int took = 0;
+
+  vbk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  if(vbk != bk)
+    acquire(&vbk->lock);
+  if(b->refcnt == 0 && !b->disk && (!clock || !b->used)){
+    hashremove(vbk, b);
+    took = 1;
+  }
+  b->used = 0;
+  if(vbk != bk)
+    release(&vbk->lock);
+  return took;
+}
+
+// A queue of buffers, on a circular list through prev/next,
+// starting at head. Policies keep their buffers on queues.
+struct bqueue {
+  struct buf *head;
+  int n;
+};
+
+// Add b to the end of q, just before its head.
+static void
+qinsert(struct bqueue *q, struct buf *b)
+{
+  if(q->head == 0){
+    b->next = b->prev = b;
+    q->head = b;
+  } else {
+    b->next = q->head;
+    b->prev = q->head->prev;
+    q->head->prev->next = b;
+    q->head->prev = b;
+  }
+  q->n++;
+}
+
+static void
+qremove(struct bqueue *q, struct buf *b)
+{
+  if(b->next == b){
+    q->head = 0;
+  } else {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    if(q->head == b)
+      q->head = b->next;
+  }
+  q->n--;
+}
+
+// Take the first unused buffer from q, oldest first.
+static struct buf*
+fifotake(struct bqueue *q, struct bucket *bk)
+{
+  struct buf *b = q->head;
+
+  for(int i = 0; i < q->n; i++, b = b->next){
+    if(btake(b, bk, 0)){
+      qremove(q, b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Take a buffer from q with the clock algorithm: the hand, q's
+// head, skips buffers in use, and clears the used bit of those
+// released since it last passed them; it takes the first it
+// finds with the bit clear.
+static struct buf*
+clocktake(struct bqueue *q, struct bucket *bk)
+{
+  struct buf *b;
+
+  for(int i = 0; i < 2*q->n; i++){
+    b = q->head;
+    q->head = b->next;
+    if(btake(b, bk, 1)){
+      qremove(q, b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+//
+// The clock policy: all buffers on one clock.
+//
+
+static struct bqueue clockq;
+
+static void
+clock_init(void)
+{
+}
+
+static void
+clock_add(struct buf *b)
+{
+  qinsert(&clockq, b);
+}
+
+static struct buf*
+clock_victim(struct bucket *bk)
+{
+  return clocktake(&clockq, bk);
+}
+
+static void
+clock_dump(void)
+{
+  printf("clock %d", clockq.n);
+}
+
+struct bpolicy clockpolicy = {
+  "clock", clock_init, clock_add, clock_victim, clock_dump,
+};
+
+//
+// The 2Q policy (Johnson and Shasha, VLDB '94), which a scan
+// of blocks read only once can't flush. A block a miss reads
+// goes on A1in, a FIFO queue, where it can take any number of
+// hits, since an operation often uses a block several times in
+// quick succession. If a block is wanted again after A1in has
+// recycled its buffer, while A1out, a list of blocks recently
+// dropped from A1in, still remembers it, it goes on Am, under
+// the clock. Misses recycle A1in's buffers while it has more
+// than a quarter of them, and A1out remembers as many blocks
+// as half the buffers.
+//
+
+#define NGHOST 4096   // A1out's most blocks
+
+// a block A1out remembers.
+struct ghost {
+  uint dev;
+  uint blockno;
+  uint seq;     // when it joined A1out
+  int live;     // still on a hash chain?
+  int hnext;    // next ghost in the chain, or -1
+};
+
+static struct {
+  struct bqueue a1in;
+  struct bqueue am;
+  // A1out is a ring, each ghost replacing the one NGHOST
+  // older, with chains by block hash for lookups.
+  struct ghost ghost[NGHOST];
+  int ghash[NBUCKET];   // first ghost in each chain, or -1
+  uint seq;             // ghosts ever added
+
+  uint nghosthit;       // misses of blocks A1out remembered
+  uint nin;             // buffers recycled from A1in
+  uint nam;             // and from Am
+} twoq;
+
+static void
+ghostunlink(int i)
+{
+  struct ghost *g = &twoq.ghost[i];
+  int *pp;
+
+  for(pp = &twoq.ghash[HASH(g->dev, g->blockno)]; *pp != i; pp = &twoq.ghost[*pp].hnext)
+    ;
+  *pp = g->hnext;
+  g->live = 0;
+}
+
+static void
+ghostadd(uint dev, uint blockno)
+{
+  int i = twoq.seq % NGHOST;
+  struct ghost *g = &twoq.ghost[i];
+  int h = HASH(dev, blockno);
+
+  if(g->live)
+    ghostunlink(i);
+  g->dev = dev;
+  g->blockno = blockno;
+  g->seq = twoq.seq++;
+  g->live = 1;
+  g->hnext = twoq.ghash[h];
+  twoq.ghash[h] = i;
+}
+
+// Does A1out remember block (dev, blockno)? If it does,
+// forget it, since the block is back in the cache.
+static int
+ghostfind(uint dev, uint blockno)
+{
+  uint kout;
+
+  kout = bcache.nbuf / 2;
+  if(kout > NGHOST)
+    kout = NGHOST;
+  for(int i = twoq.ghash[HASH(dev, blockno)]; i >= 0; i = twoq.ghost[i].hnext){
+    struct ghost *g = &twoq.ghost[i];
+    if(g->dev == dev && g->blockno == blockno){
+      ghostunlink(i);
+      return twoq.seq - g->seq <= kout;
+    }
+  }
+  return 0;
+}
+
+static void
+twoq_init(void)
+{
+  for(int i = 0; i < NBUCKET; i++)
+    twoq.ghash[i] = -1;
+}
+
+static void
+twoq_add(struct buf *b)
+{
+  if(ghostfind(b->dev, b->blockno)){
+    twoq.nghosthit++;
+    qinsert(&twoq.am, b);
+  } else {
+    qinsert(&twoq.a1in, b);
+  }
+}
+
+// Recycle A1in's oldest unused buffer, remembering its
+// block in A1out.
+static struct buf*
+twoq_a1in(struct bucket *bk)
+{
+  struct buf *b;
+
+  if((b = fifotake(&twoq.a1in, bk)) == 0)
+    return 0;
+  if(b->valid)
+    ghostadd(b->dev, b->blockno);
+  twoq.nin++;
+  return b;
+}
+
+static struct buf*
+twoq_victim(struct bucket *bk)
+{
+  struct buf *b;
+
+  if(twoq.a1in.n > bcache.nbuf / 4 && (b = twoq_a1in(bk)) != 0)
+    return b;
+  if((b = clocktake(&twoq.am, bk)) != 0){
+    twoq.nam++;
+    return b;
+  }
+  return twoq_a1in(bk);
+}
+
+static void
+twoq_dump(void)
+{
+  printf("2q a1in %d am %d; recycled a1in %d am %d; a1out hits %d",
+         twoq.a1in.n, twoq.am.n, twoq.nin, twoq.nam, twoq.nghosthit);
+}
+
+struct bpolicy twoqpolicy = {
+  "2q", twoq_init, twoq_add, twoq_victim, twoq_dump,
+};
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf), bufctor);
+  bcache.maxbuf = (PHYSTOP - KERNBASE) / BCACHEFRAC / sizeof(struct buf);
+#ifdef BCLOCK
+  bcache.policy = &clockpolicy;
+#else
+  bcache.policy = &twoqpolicy;
+#endif
+  bcache.policy->init();
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // start with NBUF buffers, enough for the log; bget()
+  // adds more as they're needed.
+  for(int i = 0; i < NBUF; i++){
+    if((b = kmem_cache_alloc(bcache.cache)) == 0)
+      panic("binit");
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->used = 0;
+    hashinsert(&bcache.bucket[HASH(0, 0)], b);
+    bcache.policy->add(b);
+    bcache.nbuf++;
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Find the buffer for block (dev, blockno) in bucket bk, which
+// the caller has locked, and take a reference to it.
+// Returns 0 if the block is not cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b != 0; b = b->hnext){
     if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      if(b->refcnt++ == 0)
+        __sync_fetch_and_add(&bcache.nbusy, 1);
+      bk->nhit++;
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b, *nb;
+
+  bk = &bcache.bucket[HASH(dev, blockno)];
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. While the cache is below its limit, grow it
+  // by a buffer, allocated before taking any locks, since
+  // kalloc() may call breclaim() if memory is short.
+  nb = 0;
+  if(bcache.nbuf < bcache.maxbuf)   // racy peek; checked below.
+    nb = kmem_cache_alloc(bcache.cache);
+
+  // Look again under bcache.lock, in case another process
+  // loaded it meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) == 0){
+    bcache.nmiss++;
+    if(nb && bcache.nbuf < bcache.maxbuf){
+      b = nb;
+      nb = 0;
+      bcache.nbuf++;
+    } else if((b = bcache.policy->victim(bk)) == 0){
+      panic("bget: no buffers");
     }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refcnt = 1;
+    b->used = 0;
+    hashinsert(bk, b);
+    bcache.policy->add(b);
+    __sync_fetch_and_add(&bcache.nbusy, 1);
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(nb)
+    kmem_cache_free(bcache.cache, nb);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -95,6 +496,8 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
+  if(b->disk)
+    virtio_disk_wait(b);   // breadahead() started it.
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +505,49 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// If block (dev, blockno) is in the cache, copy it to dst,
+// and return 1; return 0, without adding it, if it isn't.
+// The cached copy may be newer than the disk's, if it is in
+// the log and not yet installed. For the page cache, which
+// reads other blocks from the disk itself.
+int
+bpeek(uint dev, uint blockno, char *dst)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = &bcache.bucket[HASH(dev, blockno)];
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b == 0)
+    return 0;
+  acquiresleep(&b->lock);
+  if(b->disk)
+    virtio_disk_wait(b);   // breadahead() started it.
+  if(!b->valid){
+    virtio_disk_rw(b, 0);
+    b->valid = 1;
+  }
+  memmove(dst, b->data, BSIZE);
+  brelse(b);
+  return 1;
+}
+
+// Start reading a block that will likely be wanted soon into
+// the cache, without waiting for it. A bread() of the block
+// waits for the read to finish.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!b->valid && !b->disk)
+    virtio_disk_start(b);
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,42 +558,104 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Mark it used, for the policy's clock.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b can't change buckets while this holds a reference.
+  bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    __sync_fetch_and_sub(&bcache.nbusy, 1);
   }
-  
-  release(&bcache.lock);
+  b->used = 1;
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(b->refcnt++ == 0)
+    __sync_fetch_and_add(&bcache.nbusy, 1);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(--b->refcnt == 0)
+    __sync_fetch_and_sub(&bcache.nbusy, 1);
+  release(&bk->lock);
+}
+
+// Give unused buffers back to the allocator when memory runs
+// low, as the policy picks them, but keep at least NBUF.
+// Called by kalloc(). The buffers go straight back to their
+// slabs, not to a magazine, so that whole slab pages are freed.
+// Returns the number of pages freed.
+int
+breclaim(void)
+{
+  struct buf *b, *freed = 0;
+  int n = 0, npage = 0;
+
   acquire(&bcache.lock);
-  b->refcnt--;
+  while(n < NRECLAIM && bcache.nbuf > NBUF && (b = bcache.policy->victim(0)) != 0){
+    bcache.nbuf--;
+    b->next = freed;
+    freed = b;
+    n++;
+  }
   release(&bcache.lock);
+
+  while((b = freed) != 0){
+    freed = b->next;
+    npage += kmem_cache_release(bcache.cache, b);
+  }
+  return npage;
+}
+
+// Report buffer cache usage for sysinfo().
+void
+binfo(struct sysinfo *info)
+{
+  uint64 nhit = 0;
+
+  for(struct bucket *bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    nhit += bk->nhit;
+  info->nbuf = bcache.nbuf;
+  info->nbufbusy = bcache.nbusy;
+  info->nbufhit = nhit;
+  info->nbufmiss = bcache.nmiss;
 }
 
+// Print lock statistics for the buffer cache to the console.
+// For debugging; see ^P.
+void
+bdump(void)
+{
+  uint n = 0, nts = 0;
 
+  for(struct bucket *bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    n += bk->lock.n;
+    nts += bk->lock.nts;
+  }
+  printf("bcache: bufs %d busy %d; buckets acquires %d spins %d; misses acquires %d spins %d\n",
+         bcache.nbuf, bcache.nbusy, n, nts, bcache.lock.n, bcache.lock.nts);
+  printf("bcache policy: ");
+  bcache.policy->dump();
+  printf("\n");
+}
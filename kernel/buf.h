@@ -5,7 +5,9 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int used;         // released since the clock hand passed?
+  struct buf *hnext; // hash bucket list
+  struct buf *prev; // replacement policy's queue
   struct buf *next;
   uchar data[BSIZE];
 };
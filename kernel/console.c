@@ -6,7 +6,7 @@
 //   control-h -- backspace
 //   control-u -- kill line
 //   control-d -- end of file
-//   control-p -- print process list
+//   control-p -- print process list and allocator statistics
 //
 
 #include <stdarg.h>
@@ -60,6 +60,10 @@ consolewrite(int user_src, uint64 src, int n)
 {
   int i;
 
+  // either_copyin() can't read a mapped file's or a swapped-out
+  // page under cons.lock.
+  if(user_src)
+    uvmprefault(myproc(), src, n);
   acquire(&cons.lock);
   for(i = 0; i < n; i++){
     char c;
@@ -86,6 +90,8 @@ consoleread(int user_dst, uint64 dst, int n)
   char cbuf;
 
   target = n;
+  if(user_dst)
+    uvmprefault(myproc(), dst, n);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -142,6 +148,8 @@ consoleintr(int c)
   switch(c){
   case C('P'):  // Print process list.
     procdump();
+    kmemdump();
+    bdump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
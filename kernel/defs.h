@@ -2,20 +2,31 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct pcnode;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct sysinfo;
+struct text;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
+int             bpeek(uint, uint, char*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            binfo(struct sysinfo*);
+void            bdump(void);
+int             breclaim(void);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +35,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -37,8 +49,10 @@ int             filewrite(struct file*, uint64, int n);
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+uint            dirinum(struct inode*, char*, uint*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
+uint            bmap(struct inode*, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -62,19 +76,52 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void*           kalloc_zeroed(void);
+void            kref(void *);
+int             krefcount(void *);
+int             kzero_idle(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
 void            kinit(void);
+void            kmemdump(void);
+void            kallocinfo(struct sysinfo*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_sync(void);
+void            logflusher(void);
+void            loginfo(struct sysinfo*);
+
+// mmap.c
+uint64          mmap(struct proc*, uint64, int, int, struct file*, uint64);
+int             munmap(struct proc*, uint64, uint64);
+uint64          mmapbase(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
+struct vma*     vmalookup(struct proc*, uint64);
+struct vma*     vmaoverlap(struct proc*, uint64, uint64);
+void            vmaprefault(struct proc*, uint64, uint64);
+int             vmafill(struct proc*, struct vma*, uint64);
+uint64          shmat(struct proc*, int, uint64);
+int             shmdt(struct proc*, uint64);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcget(struct inode*, uint);
+int             pccached(struct inode*, uint);
+void            pcwrite(struct inode*, uint, char*, uint);
+void            pcdrop(struct inode*);
+int             pcreclaim(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+void            pipeinit(void);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,9 +132,11 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**, int);
+void            kthread(char*, void (*)(void));
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(struct proc *, pagetable_t, uint64);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -104,6 +153,9 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+uint64          proc_satp(struct proc*);
+void            proc_tlbflush(struct proc*);
+void            procinfo(struct sysinfo*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -115,6 +167,24 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             cansleep(void);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             kmem_cache_release(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+
+// shm.c
+void            shminit(void);
+struct shm*     shmget(int, uint);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint64          shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -126,11 +196,22 @@ void            initsleeplock(struct sleeplock*, char*);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            pagezero(void*, uint64);
+#ifdef MEMBENCH
+void            membench(void);
+#endif
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+int             swapout(struct proc*);
+int             swapin(struct proc*, pte_t*);
+int             swapdup(uint64);
+void            swapfree(uint64);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -139,6 +220,13 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// text.c
+void            textinit(void);
+struct text*    textload(struct inode*);
+int             textpage(struct inode*, uint64, uint, uint, int, char**);
+void            textinval(struct inode*);
+int             textreclaim(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -156,21 +244,32 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(void);
 uint64          kvmpa(uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapsuperpage(pagetable_t, uint64, uint64, int);
+pte_t *         walkleaf(pagetable_t, uint64, uint64 *);
 pagetable_t     uvmcreate(void);
+int             uvmkmap(pagetable_t);
+void            uvmkunmap(pagetable_t);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmsplitshared(pagetable_t, uint64);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             vmfault(struct proc*, uint64, int);
+void            uvmprefault(struct proc*, uint64, uint64);
+void            vminfo(struct sysinfo*);
 
 // plic.c
 void            plicinit(void);
@@ -181,7 +280,12 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_start(struct buf *);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_rwpage(int, uint64, void*, int);
+void            virtio_disk_readblocks(uint, void*, uint);
+uint64          virtio_disk_size(int);
+void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,20 +6,52 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "text.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// PROT_ bits for a segment's ELF flags.
+static int
+flags2prot(int flags)
+{
+  int prot = 0;
+
+  if(flags & ELF_PROG_FLAG_READ)
+    prot |= PROT_READ;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    prot |= PROT_WRITE;
+  if(flags & ELF_PROG_FLAG_EXEC)
+    prot |= PROT_EXEC;
+  return prot;
+}
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace p's user memory with the program path, for exec(),
+// or for spawn() with a new process that has none yet.
+// The program's segments aren't read here: each becomes a
+// private region of the program file (see mmap.c), which
+// vmfault() reads a page at a time as the program touches it.
+// The ELF headers come from the text cache (see text.c).
+// Returns argc, for a0, or -1 on failure.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
-  struct elfhdr elf;
+  int i, nseg = 0;
+  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase, entry;
   struct inode *ip;
+  struct text *t;
   struct proghdr ph;
+  struct vma seg[NVMA];
+  struct file *f = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op();
 
@@ -29,39 +61,47 @@ exec(char *path, char **argv)
   }
   ilock(ip);
 
-  // Check ELF header
-  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
+  if((t = textload(ip)) == 0)
     goto bad;
+  entry = t->elf.entry;
 
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
+  // Record the program's segments, in order of address.
+  for(i = 0; i < t->nph; i++){
+    ph = t->ph[i];
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MAXUVA)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < PGROUNDUP(sz))
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    seg[nseg].addr = ph.vaddr;
+    seg[nseg].len = PGROUNDUP(ph.vaddr + ph.memsz) - ph.vaddr;
+    seg[nseg].prot = flags2prot(ph.flags);
+    seg[nseg].flags = MAP_PRIVATE | VMA_TEXT;
+    seg[nseg].shm = 0;
+    seg[nseg].off = ph.off;
+    seg[nseg].dataend = ph.vaddr + ph.filesz;
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
+  }
+  // the segments hold the program file open.
+  if(nseg > 0){
+    if((f = filealloc()) == 0)
       goto bad;
+    f->type = FD_INODE;
+    f->readable = 1;
+    f->writable = 0;
+    f->ip = idup(ip);
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -108,50 +148,39 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
+  // The old image's memory-mapped files go with it.
+  mmapexit(p);
+
   // Commit to the user image.
+  for(i = 0; i < nseg; i++){
+    p->vma[i] = seg[i];
+    p->vma[i].file = i == 0 ? f : filedup(f);
+  }
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
+  p->rss = 1;   // just the stack, so far.
+  p->trapframe->epc = entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  if(p == myproc()){
+    // we are running on the old page table; switch.
+    push_off();
+    w_satp(proc_satp(p));
+    proc_tlbflush(p);
+    pop_off();
+  }
+  proc_freepagetable(p, oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(p, pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(f)
+    fileclose(f);
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
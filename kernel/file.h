@@ -18,6 +18,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // icache list
+  struct text *text;  // cached program; see text.c
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +29,13 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  struct pcnode *pcroot;  // page cache radix tree; see pcache.c
+  int pcheight;           // levels in the tree, 0 if empty
+
+  uint raoff;             // where the last read ended; see readahead()
+  uint rablock;           // blocks before this are read ahead
+  uint rawin;             // readahead window, in blocks
 };
 
 // map major device number to device functions.
@@ -171,43 +171,62 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+//
+// In-memory inodes come from a slab cache and live on the
+// icache.list, so the number of inodes in use is limited only
+// by memory. iput() frees an unreferenced inode once the cache
+// holds more than NINODE of them; otherwise it stays on the
+// list for reuse by iget().
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *list;
+  int n;              // number of inodes on list
 } icache;
 
+static void
+inodector(void *p)
+{
+  initsleeplock(&((struct inode*)p)->lock, "inode");
+  ((struct inode*)p)->text = 0;
+  ((struct inode*)p)->pcroot = 0;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode), inodector);
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there is no memory for the in-memory inode.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -239,6 +258,7 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new one.
 static struct inode*
 iget(uint dev, uint inum)
 {
@@ -248,7 +268,7 @@ iget(uint dev, uint inum)
 
   // Is the inode already cached?
   empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+  for(ip = icache.list; ip; ip = ip->next){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
@@ -258,15 +278,27 @@ iget(uint dev, uint inum)
       empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Recycle an inode cache entry, or make a new one.
+  if(empty){
+    ip = empty;
+    textinval(ip);
+    pcdrop(ip);
+  } else {
+    if((ip = kmem_cache_alloc(icache.cache)) == 0){
+      release(&icache.lock);
+      return 0;
+    }
+    ip->next = icache.list;
+    icache.list = ip;
+    icache.n++;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = 0;
+  ip->rablock = 0;
+  ip->rawin = 0;
   release(&icache.lock);
 
   return ip;
@@ -295,6 +327,7 @@ ilock(struct inode *ip)
     panic("ilock");
 
   acquiresleep(&ip->lock);
+  myproc()->nilock++;
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -319,6 +352,7 @@ iunlock(struct inode *ip)
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  myproc()->nilock--;
   releasesleep(&ip->lock);
 }
 
@@ -354,6 +388,17 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0 && icache.n > NINODE){
+    // too many idle inodes cached; give this one back.
+    struct inode **pp;
+    for(pp = &icache.list; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    icache.n--;
+    textinval(ip);
+    pcdrop(ip);
+    kmem_cache_free(icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -374,7 +419,7 @@ iunlockput(struct inode *ip)
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
-static uint
+uint
 bmap(struct inode *ip, uint bn)
 {
   uint addr, *a;
@@ -413,6 +458,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);
+  pcdrop(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -448,6 +495,45 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Readahead. A read of ip that starts where the last one
+// ended is sequential, and each such read in a row doubles
+// the window, from RAMIN up to RAMAX blocks. A sequential read
+// starts reading the window's blocks past its end into the
+// buffer cache, without waiting, so that the next reads find
+// them there or on the way; blocks of pages that are in the
+// page cache are skipped. Any other read closes the window.
+#define RAMIN 4
+#define RAMAX 64
+
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, nblocks;
+
+  if(off != ip->raoff){
+    ip->raoff = off + n;
+    ip->rablock = 0;
+    ip->rawin = 0;
+    return;
+  }
+  ip->raoff = off + n;
+  ip->rawin = ip->rawin == 0 ? RAMIN : min(2*ip->rawin, RAMAX);
+
+  // the first block past this read.
+  bn = (off + n + BSIZE - 1) / BSIZE;
+  end = bn + ip->rawin;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  if(end > nblocks)
+    end = nblocks;
+  if(bn < ip->rablock)
+    bn = ip->rablock;   // already started.
+  for(; bn < end; bn++)
+    if(!pccached(ip, bn*BSIZE / PGSIZE))
+      breadahead(ip->dev, bmap(ip, bn));
+  if(end > ip->rablock)
+    ip->rablock = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -457,20 +543,30 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *pa;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if((pa = pcget(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, pa + (off % PGSIZE), m);
+      kfree(pa);
+    } else {
+      // no memory for the page cache; use the buffer cache.
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
       brelse(bp);
-      break;
     }
-    brelse(bp);
+    if(r == -1)
+      break;
   }
   return tot;
 }
@@ -489,6 +585,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(n > 0)
+    textinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -497,6 +595,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcwrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -521,12 +620,13 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
+// Look for a directory entry in a directory, and return
+// its inode number, or 0 if there is none.
 // If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+uint
+dirinum(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off;
   struct dirent de;
 
   if(dp->type != T_DIR)
@@ -541,27 +641,37 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory, and return its
+// inode. Returns 0 if there is none, or if there is no memory
+// for the inode; dirinum() tells them apart.
+// If found, set *poff to byte offset of entry.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if((inum = dirinum(dp, name, poff)) == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
   // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  if(dirinum(dp, name, 0) != 0)
     return -1;
-  }
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -631,6 +741,8 @@ namex(char *path, int nameiparent, char *name)
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
+  if(ip == 0)
+    return 0;   // no memory for the root's inode
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
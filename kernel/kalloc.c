@@ -1,6 +1,29 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is managed by a binary buddy allocator, which hands
+// out physically contiguous blocks of 2^order pages (order 0 to
+// MAXORDER) through kalloc_pages() and kfree_pages(), and merges
+// freed blocks with their buddies.
+//
+// Single pages, which are almost all allocations, go through
+// kalloc() and kfree(). Each CPU keeps its own list of free pages
+// with its own lock, so that kalloc() and kfree() on different
+// CPUs don't contend. A CPU refills its list from the buddy
+// allocator NBATCH pages at a time, and returns pages in batches
+// when its list grows long. If the buddy allocator is empty too,
+// the CPU steals a batch of pages from another CPU's list.
+//
+// kalloc_zeroed() hands out pages that are already zero, from a
+// pool of up to NZPAGE pages that idle CPUs fill from the
+// scheduler loop (see kzero_idle()), so that zeroing a page is
+// usually off the path of the process that needs it.
+//
+// Every allocated page has a reference count, so that copy-on-write
+// fork can share a page between processes. kalloc() sets the count
+// to one, kref() adds a reference, and kfree() only frees the page
+// once the last reference is gone.
 
 #include "types.h"
 #include "param.h"
@@ -8,25 +31,84 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "sysinfo.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+extern int nsuperpage; // user megapage mappings; see vm.c.
+
+// pages moved between a CPU's list and the buddy allocator,
+// or between CPUs, at once.
+#define NBATCH 32
+
+// a CPU returns a batch to the buddy allocator when
+// its list holds more than this many pages.
+#define KMEM_HIGH (4*NBATCH)
+
+// index of the physical page holding pa.
+#define PGINDEX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define NPAGE PGINDEX(PHYSTOP)
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;     // number of pages on freelist
+  uint nsteal;   // number of times this CPU stole pages
+};
+
+struct kmem kmem[NCPU];
+
+// a free buddy block, stored in its first page.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  uint64 base;                    // lowest page the allocator manages
+  int nfree;                      // free pages, in all orders
+  struct block free[MAXORDER+1];  // circular free list per order
+  // order[i] is k+1 if page i is the first page of a
+  // free block of order k, and 0 otherwise.
+  char order[NPAGE];
+} buddy;
+
+// reference count of each allocated page, indexed by PGINDEX.
+// updated with atomic instructions rather than under a lock.
+int pageref[NPAGE];
+
+// pages that have already been zeroed.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} zpool;
+
+// times kalloc1() asks the caches for pages before failing.
+#define NRECLAIMTRY 4
+
+// pages zeroed per call to kzero_idle(), so that an
+// idle CPU notices new RUNNABLE processes promptly.
+#define NZBATCH 8
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  initlock(&zpool.lock, "zpool");
+  for(int k = 0; k <= MAXORDER; k++)
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+  buddy.base = PGROUNDUP((uint64)end);
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +117,353 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pageref[PGINDEX(p)] = 1;
     kfree(p);
+  }
+}
+
+static void
+bd_insert(uint64 pa, int k)
+{
+  struct block *b = (struct block*)pa;
+  struct block *h = &buddy.free[k];
+
+  b->next = h->next;
+  b->prev = h;
+  h->next->prev = b;
+  h->next = b;
+  buddy.order[PGINDEX(pa)] = k + 1;
+}
+
+static void
+bd_remove(uint64 pa)
+{
+  struct block *b = (struct block*)pa;
+
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.order[PGINDEX(pa)] = 0;
+}
+
+// Take a block of 2^order pages off the free lists,
+// splitting a larger block if need be.
+// Caller must hold buddy.lock.
+static void*
+bd_alloc(int order)
+{
+  uint64 pa;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.free[k].next != &buddy.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  pa = (uint64)buddy.free[k].next;
+  bd_remove(pa);
+  // give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    bd_insert(pa + ((uint64)PGSIZE << k), k);
+  }
+  buddy.nfree -= 1 << order;
+  return (void*)pa;
+}
+
+// Put a block of 2^order pages back on the free lists,
+// merging it with its buddy for as long as the buddy
+// is free too.
+// Caller must hold buddy.lock.
+static void
+bd_free(uint64 pa, int order)
+{
+  uint64 bpa;
+  int k;
+
+  buddy.nfree += 1 << order;
+  for(k = order; k < MAXORDER; k++){
+    bpa = pa ^ ((uint64)PGSIZE << k);
+    if(bpa < buddy.base || bpa >= PHYSTOP || buddy.order[PGINDEX(bpa)] != k + 1)
+      break;
+    bd_remove(bpa);
+    if(bpa < pa)
+      pa = bpa;
+  }
+  bd_insert(pa, k);
+}
+
+// Give every page on a CPU's list back to the buddy allocator,
+// so that they can be merged into larger blocks.
+static void
+drain(struct kmem *km)
+{
+  struct run *r;
+
+  acquire(&km->lock);
+  r = km->freelist;
+  km->freelist = 0;
+  km->nfree = 0;
+  release(&km->lock);
+
+  acquire(&buddy.lock);
+  while(r){
+    struct run *next = r->next;
+    bd_free((uint64)r, 0);
+    r = next;
+  }
+  release(&buddy.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void*
+kalloc_pages(int order)
+{
+  void *pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages");
+
+  acquire(&buddy.lock);
+  pa = bd_alloc(order);
+  release(&buddy.lock);
+
+  if(pa == 0 && order > 0){
+    // the pages we need may be sitting on CPU lists.
+    for(int i = 0; i < NCPU; i++)
+      drain(&kmem[i]);
+    acquire(&buddy.lock);
+    pa = bd_alloc(order);
+    release(&buddy.lock);
+  }
+
+  if(pa){
+    for(int i = 0; i < (1 << order); i++)
+      pageref[PGINDEX(pa) + i] = 1;
+    memset(pa, 5, (uint64)PGSIZE << order); // fill with junk
+  }
+  return pa;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Free 2^order pages returned by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 sz = (uint64)PGSIZE << order;
+
+  if(order < 0 || order > MAXORDER || ((uint64)pa % sz) != 0 ||
+     (uint64)pa < buddy.base || (uint64)pa + sz > PHYSTOP)
+    panic("kfree_pages");
+  for(int i = 0; i < (1 << order); i++)
+    pageref[PGINDEX(pa) + i] = 0;
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, sz);
+
+  acquire(&buddy.lock);
+  bd_free((uint64)pa, order);
+  release(&buddy.lock);
+}
+
+// Drop a reference to the page of physical memory pointed at
+// by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kmem *km;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pageref[PGINDEX(pa)], 1);
+  if(n < 0)
+    panic("kfree: ref");
+  if(n > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  batch = 0;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  if(km->nfree > KMEM_HIGH){
+    // list is long; hand a batch back to the buddy allocator.
+    batch = km->freelist;
+    r = batch;
+    for(int i = 1; i < NBATCH; i++)
+      r = r->next;
+    km->freelist = r->next;
+    r->next = 0;
+    km->nfree -= NBATCH;
+  }
+  release(&km->lock);
+  pop_off();
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  if(batch){
+    acquire(&buddy.lock);
+    for(r = batch; r; r = batch){
+      batch = r->next;
+      bd_free((uint64)r, 0);
+    }
+    release(&buddy.lock);
+  }
+}
+
+// Refill CPU id's empty list with up to NBATCH pages from the
+// buddy allocator and return one of them.
+// Caller must have interrupts disabled.
+static struct run*
+refill(int id)
+{
+  struct run *r, *first;
+  int n;
+
+  first = 0;
+  acquire(&buddy.lock);
+  for(n = 0; n < NBATCH; n++){
+    if((r = bd_alloc(0)) == 0)
+      break;
+    r->next = first;
+    first = r;
+  }
+  release(&buddy.lock);
+
+  if(n > 1){
+    acquire(&kmem[id].lock);
+    r = first->next;
+    while(r->next)
+      r = r->next;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = first->next;
+    kmem[id].nfree += n - 1;
+    release(&kmem[id].lock);
+  }
+  return first;
+}
+
+// Move up to half (at most NBATCH) of another CPU's free
+// pages to CPU id's list, and return one of them.
+// Only one kmem lock is held at a time, so two CPUs
+// stealing from each other cannot deadlock.
+// Caller must have interrupts disabled.
+static struct run*
+steal(int id)
+{
+  struct run *r, *first, *last;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    struct kmem *victim = &kmem[(id + i) % NCPU];
+
+    acquire(&victim->lock);
+    n = (victim->nfree + 1) / 2;
+    if(n > NBATCH)
+      n = NBATCH;
+    first = last = victim->freelist;
+    for(int j = 1; j < n; j++)
+      last = last->next;
+    if(n > 0){
+      victim->freelist = last->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n == 0)
+      continue;
+
+    // keep the first page for the caller, and
+    // put the rest on our own list.
+    r = first;
+    acquire(&kmem[id].lock);
+    if(n > 1){
+      last->next = kmem[id].freelist;
+      kmem[id].freelist = first->next;
+      kmem[id].nfree += n - 1;
+    }
+    kmem[id].nsteal++;
+    release(&kmem[id].lock);
+    return r;
+  }
+  return 0;
+}
+
+// Take a page off the zeroed pool, or return 0.
+static struct run*
+zpool_get(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  r = zpool.list;
+  if(r){
+    zpool.list = r->next;
+    zpool.n--;
+  }
+  release(&zpool.lock);
+  return r;
+}
+
+// Take a free page off this CPU's list, refilling it from the
+// buddy allocator or another CPU's list if it is empty.
+// Returns 0 if there are no free pages.
+static struct run*
+kalloc_free(void)
+{
+  struct run *r;
+  struct kmem *km;
+  int id;
+
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+  if(r == 0)
+    r = refill(id);
+  if(r == 0)
+    r = steal(id);
+  pop_off();
+  return r;
+}
+
+// Allocate a page without initializing it. If there are no
+// free pages, have the caches give some back, and try again;
+// a bounded number of times, since another CPU may take them.
+static struct run*
+kalloc1(void)
+{
+  struct run *r;
+
+  if((r = kalloc_free()) == 0)
+    r = zpool_get();
+  for(int i = 0; r == 0 && i < NRECLAIMTRY; i++){
+    if(pcreclaim() == 0 && textreclaim() == 0 && breclaim() == 0)
+      break;
+    r = kalloc_free();
+  }
+  if(r)
+    pageref[PGINDEX(r)] = 1;
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +474,107 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  r = kalloc1();
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    memset((char*)r, 5, PGSIZE); // fill with junk
+  return (void*)r;
+}
+
+// Allocate one page of zeroed physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
 
+  if((r = zpool_get()) != 0){
+    r->next = 0;
+    return (void*)r;
+  }
+  r = kalloc1();
   if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+    pagezero(r, PGSIZE);
   return (void*)r;
 }
+
+// Called by an idle CPU's scheduler loop: zero a few
+// pages for the pool if it is below NZPAGE. The pages come
+// only from the free lists; pre-zeroing isn't worth taking
+// pages back out of the pool, or evicting cached files.
+// Returns the number of pages zeroed.
+int
+kzero_idle(void)
+{
+  struct run *r;
+  int n;
+
+  for(n = 0; n < NZBATCH; n++){
+    if(zpool.n >= NZPAGE)   // racy peek; the pool size is only a target.
+      break;
+    if((r = kalloc_free()) == 0)
+      break;
+    pageref[PGINDEX(r)] = 1;
+    pagezero(r, PGSIZE);
+    acquire(&zpool.lock);
+    r->next = zpool.list;
+    zpool.list = r;
+    zpool.n++;
+    release(&zpool.lock);
+  }
+  return n;
+}
+
+// Report free memory for sysinfo(). The counts are read
+// without locks, so the total is only a snapshot.
+void
+kallocinfo(struct sysinfo *info)
+{
+  uint64 n;
+
+  n = buddy.nfree + zpool.n;
+  for(int i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  info->freemem = n * PGSIZE;
+}
+
+// Add a reference to an allocated page, for sharing
+// it between page tables.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(&pageref[PGINDEX(pa)], 1) < 1)
+    panic("kref: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&pageref[PGINDEX(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Print per-CPU free list lengths, buddy free lists and
+// kmem lock statistics to the console. For debugging; see ^P.
+void
+kmemdump(void)
+{
+  printf("kmem:");
+  for(int i = 0; i < NCPU; i++){
+    struct kmem *km = &kmem[i];
+    if(km->lock.n == 0 && km->nfree == 0)
+      continue;
+    printf(" cpu%d: free %d steals %d acquires %d spins %d;",
+           i, km->nfree, km->nsteal, km->lock.n, km->lock.nts);
+  }
+  printf("\nzpool: %d superpages: %d\nbuddy: free %d acquires %d spins %d; blocks by order:",
+         zpool.n, nsuperpage, buddy.nfree, buddy.lock.n, buddy.lock.nts);
+  for(int k = 0; k <= MAXORDER; k++){
+    int n = 0;
+    for(struct block *b = buddy.free[k].next; b != &buddy.free[k]; b = b->next)
+      n++;
+    printf(" %d", n);
+  }
+  printf("\n");
+}
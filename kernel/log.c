@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -21,6 +22,17 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The log doesn't commit at every end_op(), but gathers the
+// updates of many system calls into one transaction, and
+// commits it once its first update is LOGAGE ticks old, when
+// the log is nearly full, or when fsync() asks. The commit
+// itself is left to the flusher kernel thread, so that no
+// system call pays for one that it merely ended up last in.
+// So a system call's updates reach the disk a little after it
+// returns; a crash loses the latest, but never half of a
+// transaction. With LOGAGE 0 there is no flusher, and every
+// end_op() with none outstanding commits.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -43,6 +55,9 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int want;        // commit as soon as none are outstanding.
+  uint ncommit;    // commits done
+  uint first;      // ticks at the transaction's first update
   int dev;
   struct logheader lh;
 };
@@ -62,6 +77,8 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  if(LOGAGE > 0)
+    kthread("flusher", logflusher);
 }
 
 // Copy committed blocks from log to their home location
@@ -121,17 +138,53 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Commit the current transaction. Caller must hold log.lock,
+// which this releases while writing, and have checked that
+// no FS system calls are outstanding, nor a commit under way.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  log.want = 0;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
+// Have the current transaction committed, by the flusher,
+// as soon as no FS system calls are outstanding. The flusher
+// sleeps on &ticks, so that the clock wakes it to check the
+// transaction's age; wake it the same way.
+// Caller must hold log.lock.
+static void
+wantcommit(void)
+{
+  if(log.committing)
+    return;   // begin_op() has kept the log from growing since.
+  log.want = 1;
+  if(LOGAGE > 0)
+    wakeup(&ticks);
+  else if(log.outstanding == 0)
+    docommit();
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.want){
+      // let the outstanding ops finish, so the commit can start.
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      wantcommit();
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -141,19 +194,20 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// if this was the last outstanding operation, and a
+// commit is wanted, has the flusher start it.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    if(LOGAGE == 0)
+      docommit();
+    else if(log.want)
+      wakeup(&ticks);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,18 +215,52 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Make the updates of all FS system calls that have returned
+// durable: commit the transaction holding them, and wait for
+// it. For fsync().
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.committing){
+    // the next commit to finish will include them.
+    n = log.ncommit + 1;
+    wantcommit();
+    while((int)(log.ncommit - n) < 0)
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// The flusher kernel thread: wants a commit once the
+// transaction's first update is LOGAGE ticks old, and does
+// every commit that is wanted, once the outstanding FS system
+// calls have finished. Woken by each clock tick.
+void
+logflusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.want && log.outstanding == 0 && !log.committing)
+      docommit();
+    else if(!log.want && log.lh.n > 0 && ticks - log.first >= LOGAGE)
+      wantcommit();
+    else
+      sleep(&ticks, &log.lock);
   }
 }
 
+// Report the number of log commits for sysinfo().
+void
+loginfo(struct sysinfo *info)
+{
+  info->nlogcommit = log.ncommit;
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
@@ -227,6 +315,8 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (log.lh.n == 0)
+      log.first = ticks;
     bpin(b);
     log.lh.n++;
   }
@@ -17,6 +17,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // kernel object allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -26,8 +27,16 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    pcacheinit();    // page cache
     fileinit();      // file table
+    pipeinit();      // pipe allocator
+    shminit();       // shared-memory segments
+    textinit();      // program text cache
     virtio_disk_init(); // emulated hard disk
+    swapinit();      // swap space on the second disk
+#ifdef MEMBENCH
+    membench();      // bulk memory loops
+#endif
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -24,6 +24,8 @@
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
@@ -62,6 +64,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   MAXUVA (the kernel's mappings of PLIC, devices and RAM)
+//   ...
+//   KSTACK (the process's own kernel stack)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
+//
+// Each process's page table also maps the kernel, so that
+// traps and system calls need not switch page tables.
+// User memory must therefore stay below the lowest kernel
+// mapping (except the CLINT, which only machine mode uses).
+#define MAXUVA PLIC
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
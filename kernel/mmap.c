@@ -0,0 +1,438 @@
+// Memory-mapped files and shared-memory segments.
+//
+// Each process has NVMA regions (struct vma in proc.h), each
+// mapping part of one file, or one shared-memory segment (see
+// shm.c). Mappings are placed downward from MAXUVA; the heap
+// grows up to meet them. mmap() and shmat() only record the
+// region: vmfault() calls vmafill() to read a page from the
+// file, or find the segment's page, the first time it is touched.
+//
+// exec() records the program's loadable segments as private
+// regions too, flagged VMA_TEXT, so that a program's pages
+// are read from its file only as it uses them. They lie below
+// p->sz, and have zeros (bss) above the segment's file data.
+// Pages of read-only segments are shared through the text
+// cache in text.c.
+//
+// A MAP_SHARED mapping's dirty pages (PTE_D) are written back
+// to the file when they are unmapped, by munmap(), exit() or
+// exec(). A fork()ed child shares a MAP_SHARED mapping's pages
+// (and a segment's) with its parent, and a MAP_PRIVATE one's
+// copy-on-write.
+
+#include "types.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "proc.h"
+#include "fcntl.h"
+
+static int
+vmaused(struct vma *v)
+{
+  return v->file != 0 || v->shm != 0;
+}
+
+// The lowest address mapped by one of p's regions,
+// or MAXUVA if there are none.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = MAXUVA;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(vmaused(v) && (v->flags & VMA_TEXT) == 0 && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// The region of p that contains va, or 0.
+struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  return vmaoverlap(p, va, va + 1);
+}
+
+// A region of p that overlaps [start, end), or 0.
+struct vma*
+vmaoverlap(struct proc *p, uint64 start, uint64 end)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(vmaused(v) && start < v->addr + v->len && end > v->addr)
+      return v;
+  return 0;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(!vmaused(v))
+      return v;
+  return 0;
+}
+
+// Drop v's reference to its file or segment,
+// leaving v unused.
+static void
+vmaclose(struct vma *v)
+{
+  if(v->file)
+    fileclose(v->file);
+  if(v->shm)
+    shmput(v->shm);
+  v->file = 0;
+  v->shm = 0;
+}
+
+// Is there room for len more bytes of mappings in p?
+// Returns the address for them if so, 0 if not.
+static uint64
+vmaroom(struct proc *p, uint64 len)
+{
+  uint64 base = mmapbase(p);
+
+  if(len > base || base - len < PGROUNDUP(p->sz))
+    return 0;
+  return base - len;
+}
+
+// Map len bytes of f, starting at offset off, into p.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(struct proc *p, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct vma *v;
+  uint64 addr;
+
+  if(len == 0 || (off % PGSIZE) != 0 || f->type != FD_INODE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(!f->readable)
+    return -1;
+  // writes to a private mapping never reach the file.
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  if((addr = vmaroom(p, len)) == 0)
+    return -1;
+  if((v = vmaalloc(p)) == 0)
+    return -1;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->off = off;
+  v->dataend = addr + len;
+  v->file = filedup(f);
+  return v->addr;
+}
+
+// PTE permission bits for a page of v.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Attach the shared-memory segment with the given key
+// to p, creating it with len bytes if it doesn't exist.
+// Returns the address of the mapping, or -1.
+uint64
+shmat(struct proc *p, int key, uint64 len)
+{
+  struct vma *v;
+  struct shm *s;
+  uint64 addr;
+
+  if(len == 0)
+    return -1;
+  if((v = vmaalloc(p)) == 0)
+    return -1;
+  if((s = shmget(key, PGROUNDUP(len) / PGSIZE)) == 0)
+    return -1;
+  len = shmsize(s);
+  if((addr = vmaroom(p, len)) == 0){
+    shmput(s);
+    return -1;
+  }
+  v->addr = addr;
+  v->len = len;
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->off = 0;
+  v->shm = s;
+  return v->addr;
+}
+
+// Detach the segment that p attached at addr.
+// Returns 0 on success, -1 on failure.
+int
+shmdt(struct proc *p, uint64 addr)
+{
+  struct vma *v;
+
+  if((v = vmalookup(p, addr)) == 0 || v->shm == 0 || v->addr != addr)
+    return -1;
+  p->rss -= uvmunmap(p->pagetable, v->addr, v->len / PGSIZE, 1);
+  proc_tlbflush(p);
+  vmaclose(v);
+  return 0;
+}
+
+// Map the page of v at va: read it from the file, or
+// find the segment's page. Part of a file's page past the
+// end of the file, or past v->dataend, reads as zeros.
+// Returns 0 on success, FAULT_NOMEM if out of memory,
+// or -1 on other failures.
+int
+vmafill(struct proc *p, struct vma *v, uint64 va)
+{
+  struct inode *ip;
+  char *mem;
+  uint64 n;
+  int sleepok, r;
+
+  if((v->prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0)
+    return -1;
+
+  if(v->shm){
+    if((mem = shmpage(v->shm, (va - v->addr) / PGSIZE)) == 0)
+      return FAULT_NOMEM;
+    goto map;
+  }
+  if(va >= v->dataend){
+    // all bss; no need to read the file.
+    if((mem = kalloc_zeroed()) == 0)
+      return FAULT_NOMEM;
+    goto map;
+  }
+  ip = v->file->ip;
+  n = v->dataend - va;
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  // reading the file may sleep, which a fault taken by
+  // copyin() or copyout() can't do while the caller holds
+  // a spinlock, such as a pipe's, nor while it holds any
+  // inode's lock, in readi() or writei(): taking ip's lock
+  // could deadlock with a process that holds ip's and is
+  // faulting on a mapping of the caller's inode. fileread()
+  // and filewrite() fault the buffer in before locking.
+  sleepok = cansleep() && p->nilock == 0;
+
+  if((v->flags & VMA_TEXT) && (v->prot & PROT_WRITE) == 0){
+    // program text: share the cached page (see text.c),
+    // which needs no sleep once some process has read it.
+    if((r = textpage(ip, va, v->off + (va - v->addr), n, sleepok, &mem)) < 0)
+      return r;
+    goto map;
+  }
+  if(!sleepok)
+    return -1;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return FAULT_NOMEM;
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, v->off + (va - v->addr), n) < 0){
+    iunlock(ip);
+    kfree(mem);
+    return -1;
+  }
+  iunlock(ip);
+
+ map:
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, vmaperm(v)) != 0){
+    kfree(mem);
+    return FAULT_NOMEM;
+  }
+  p->rss++;
+  proc_tlbflush(p);
+  return 0;
+}
+
+// Fill the pages of p's regions in [va, va+len) that are
+// not yet mapped, for a caller that is about to copy to or
+// from them while holding a spinlock, under which vmafill()
+// can't read the file. Failures are left for the copy to
+// find. Demand-zero and copy-on-write faults don't sleep,
+// so other pages needn't be touched here.
+void
+vmaprefault(struct proc *p, uint64 va, uint64 len)
+{
+  uint64 a, start, end;
+  pte_t *pte;
+
+  if(va >= MAXUVA)
+    return;
+  if(len > MAXUVA - va)
+    len = MAXUVA - va;
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!vmaused(v) || va + len <= v->addr || va >= v->addr + v->len)
+      continue;
+    start = va > v->addr ? PGROUNDDOWN(va) : v->addr;
+    end = va + len < v->addr + v->len ? va + len : v->addr + v->len;
+    for(a = start; a < end; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || *pte == 0)
+        vmafill(p, v, a);
+    }
+  }
+}
+
+// Write the page at pa back to v's file, at the offset
+// that va maps, but not past the end of the file.
+static void
+writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->file->ip;
+  uint off = v->off + (va - v->addr);
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int n, n1;
+
+  for(n = 0; n < PGSIZE; n += n1){
+    n1 = PGSIZE - n;
+    if(n1 > max)
+      n1 = max;
+    begin_op();
+    ilock(ip);
+    if(off + n >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(off + n + n1 > ip->size)
+      n1 = ip->size - (off + n);
+    writei(ip, 0, pa + n, off + n, n1);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap [va, va+len) of p's region v, writing dirty pages
+// of a shared mapping back to the file. The range must be
+// page-aligned and lie within v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  pte_t *pte;
+
+  if(v->file && v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    for(uint64 a = va; a < va + len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+        writeback(v, a, PTE2PA(*pte));
+    }
+  }
+  p->rss -= uvmunmap(p->pagetable, va, len / PGSIZE, 1);
+  proc_tlbflush(p);
+}
+
+// Remove the mappings of [addr, addr+len) from p, which
+// must lie within one file's region. Unmapping the middle
+// of a region splits it in two.
+// Returns 0 on success, -1 on failure.
+int
+munmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *nv;
+  uint64 end;
+
+  if((addr % PGSIZE) != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmalookup(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  if(v->shm)
+    return -1;   // use shmdt()
+  if(v->flags & VMA_TEXT)
+    return -1;
+  end = addr + len;
+
+  if(addr > v->addr && end < v->addr + v->len){
+    // a hole: the part above it becomes a new region.
+    if((nv = vmaalloc(p)) == 0)
+      return -1;
+    *nv = *v;
+    nv->addr = end;
+    nv->len = v->addr + v->len - end;
+    nv->off = v->off + (end - v->addr);
+    filedup(nv->file);
+    v->len = addr - v->addr;
+    vmaunmap(p, v, addr, len);
+    return 0;
+  }
+
+  vmaunmap(p, v, addr, len);
+  if(addr == v->addr){
+    v->addr = end;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0)
+    vmaclose(v);
+  return 0;
+}
+
+// Give child np copies of p's regions, sharing their pages.
+// Returns 0 on success, -1 on failure, in which case np
+// is left with no regions.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(!vmaused(v))
+      continue;
+    // uvmcopy() has copied the program's pages, below p->sz.
+    if((v->flags & VMA_TEXT) == 0 &&
+       uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                    v->flags == MAP_PRIVATE) < 0)
+      goto err;
+    *nv = *v;
+    if(nv->file)
+      filedup(nv->file);
+    if(nv->shm)
+      shmdup(nv->shm);
+  }
+  return 0;
+
+ err:
+  // p still holds each file and segment, so vmaclose()
+  // won't sleep, though fork() holds np->lock.
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(!vmaused(nv))
+      continue;
+    uvmunmap(np->pagetable, nv->addr, nv->len / PGSIZE, 1);
+    vmaclose(nv);
+  }
+  return -1;
+}
+
+// Remove all of p's regions, as for exit() or exec().
+void
+mmapexit(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!vmaused(v))
+      continue;
+    vmaunmap(p, v, v->addr, v->len);
+    vmaclose(v);
+  }
+}
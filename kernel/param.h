@@ -1,13 +1,18 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // memory-mapped regions per process
+#define NSHM         32  // shared-memory segments
+#define NINODE       50  // number of idle i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGAGE       10  // ticks an update waits in the log before commit
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define BCACHEFRAC     8   // disk block cache may grow to 1/BCACHEFRAC of memory
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER       9   // largest kalloc_pages() block is 2^MAXORDER pages
+#define NZPAGE       128   // pre-zeroed pages kept for kalloc_zeroed()
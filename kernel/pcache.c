@@ -0,0 +1,319 @@
+// Page cache.
+//
+// readi() reads file data through a per-inode cache of whole
+// pages, so that re-reading a file doesn't go to the buffer
+// cache, which is small and better kept for metadata and the
+// log. A page is read straight from the disk on the first read
+// of it, without taking buffers, except for blocks that the
+// buffer cache already holds: those written and still in the
+// log, which may be newer than the disk, and those read ahead
+// (see readahead() in fs.c). writei() still writes through the
+// buffer cache and the log, and copies what it writes into the
+// cached page, if there is one, so the cache never goes stale.
+//
+// So file data is in the buffer cache only on its way to the
+// disk, or between a read ahead and the fill that copies it.
+// The default 2Q policy (see bio.c) keeps such buffers on its
+// FIFO A1in queue, which misses recycle before the metadata
+// that gets used again, on Am.
+//
+// Each inode's pages hang off a radix tree keyed by page
+// number (file offset / PGSIZE): interior nodes hold PCFANOUT
+// pointers, and the tree grows a level taller whenever a page
+// number doesn't fit. The cache has no fixed size: it grows
+// while there is free memory, and kalloc() calls pcreclaim()
+// to free the least recently used pages when memory runs out.
+//
+// Locking: an inode's lock protects the shape of its tree
+// (ip->pcroot, ip->pcheight, and the interior nodes), which
+// only changes as pages are added or the whole cache of the
+// inode is dropped. pcache.lock protects the leaf slots and
+// the LRU list, since pcreclaim() removes pages from any
+// inode's tree without holding its lock. A page being copied
+// from is pinned with a kref(), and pcreclaim() leaves pinned
+// pages alone.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "buf.h"
+#include "defs.h"
+
+#define PCBITS     6
+#define PCFANOUT   (1 << PCBITS)
+#define PCMASK     (PCFANOUT - 1)
+#define PCRECLAIM  32   // pages pcreclaim() frees at a time
+
+struct pcnode {
+  void *slot[PCFANOUT];   // struct pcnode*, or at the bottom, struct pcpage*
+};
+
+struct pcpage {
+  char *pa;               // the cached data
+  struct pcpage **slot;   // where the tree points to this page
+  struct pcpage *prev;    // LRU list
+  struct pcpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache *nodes;
+  struct kmem_cache *pages;
+
+  // pages sorted by how recently they were read;
+  // lru.next is most recent, lru.prev is least.
+  struct pcpage lru;
+  int n;   // number of cached pages
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.nodes = kmem_cache_create("pcnode", sizeof(struct pcnode), 0);
+  pcache.pages = kmem_cache_create("pcpage", sizeof(struct pcpage), 0);
+  pcache.lru.prev = &pcache.lru;
+  pcache.lru.next = &pcache.lru;
+}
+
+static struct pcnode*
+pcnodealloc(void)
+{
+  struct pcnode *n;
+
+  if((n = kmem_cache_alloc(pcache.nodes)) != 0)
+    memset(n, 0, sizeof(*n));
+  return n;
+}
+
+// Find the slot for page number pn in ip's tree. If create
+// is set, add the nodes that lead to it, growing the tree
+// if it's too short to hold pn. Caller must hold ip->lock.
+// Returns 0 if there is no slot, or out of memory.
+static struct pcpage**
+pcslot(struct inode *ip, uint pn, int create)
+{
+  struct pcnode *n;
+  int h;
+
+  if(ip->pcroot == 0){
+    if(!create || (ip->pcroot = pcnodealloc()) == 0)
+      return 0;
+    ip->pcheight = 1;
+  }
+  while(((uint64)pn >> (PCBITS*ip->pcheight)) != 0){
+    if(!create || (n = pcnodealloc()) == 0)
+      return 0;
+    n->slot[0] = ip->pcroot;
+    ip->pcroot = n;
+    ip->pcheight++;
+  }
+
+  n = ip->pcroot;
+  for(h = ip->pcheight - 1; h > 0; h--){
+    void **p = &n->slot[(pn >> (PCBITS*h)) & PCMASK];
+    if(*p == 0 && (!create || (*p = pcnodealloc()) == 0))
+      return 0;
+    n = *p;
+  }
+  return (struct pcpage**)&n->slot[pn & PCMASK];
+}
+
+// Remove pg from the LRU list. Caller must hold pcache.lock.
+static void
+lru_remove(struct pcpage *pg)
+{
+  pg->next->prev = pg->prev;
+  pg->prev->next = pg->next;
+}
+
+// Make pg the most recently used page.
+// Caller must hold pcache.lock.
+static void
+lru_push(struct pcpage *pg)
+{
+  pg->next = pcache.lru.next;
+  pg->prev = &pcache.lru;
+  pcache.lru.next->prev = pg;
+  pcache.lru.next = pg;
+}
+
+// Take pg out of the cache and free it.
+// Caller must hold pcache.lock.
+static void
+pcpagefree(struct pcpage *pg)
+{
+  *pg->slot = 0;
+  lru_remove(pg);
+  pcache.n--;
+  kfree(pg->pa);
+  kmem_cache_free(pcache.pages, pg);
+}
+
+// Read page pn of ip into a new page and add it to the
+// cache. Caller must hold ip->lock.
+static char*
+pcfill(struct inode *ip, uint pn)
+{
+  struct pcpage **slot, *pg;
+  uint bn[PGSIZE/BSIZE];
+  int have[PGSIZE/BSIZE];
+  char *mem;
+  uint off;
+  int i, j, nb;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  if((pg = kmem_cache_alloc(pcache.pages)) == 0){
+    kfree(mem);
+    return 0;
+  }
+  if((slot = pcslot(ip, pn, 1)) == 0){
+    kmem_cache_free(pcache.pages, pg);
+    kfree(mem);
+    return 0;
+  }
+
+  // take the blocks the buffer cache holds from it, since they
+  // may be newer than the disk; read the rest straight from the
+  // disk, a run of blocks that are adjacent on disk at a time.
+  nb = 0;
+  for(off = 0; off < PGSIZE && pn*PGSIZE + off < ip->size; off += BSIZE){
+    bn[nb] = bmap(ip, (pn*PGSIZE + off) / BSIZE);
+    have[nb] = bpeek(ip->dev, bn[nb], mem + off);
+    nb++;
+  }
+  memset(mem + off, 0, PGSIZE - off);
+  for(i = 0; i < nb; i = j){
+    j = i + 1;
+    if(have[i])
+      continue;
+    while(j < nb && !have[j] && bn[j] == bn[j-1] + 1)
+      j++;
+    virtio_disk_readblocks(bn[i], mem + i*BSIZE, j - i);
+  }
+
+  pg->pa = mem;
+  pg->slot = slot;
+  kref(mem);   // for the caller; the cache keeps kalloc()'s.
+  acquire(&pcache.lock);
+  *slot = pg;
+  lru_push(pg);
+  pcache.n++;
+  release(&pcache.lock);
+  return mem;
+}
+
+// Return page pn of ip's data, from the cache or read into
+// it, pinned for the caller, who must kfree() it when done.
+// Bytes past the end of the file read as zeros.
+// Caller must hold ip->lock.
+// Returns 0 if out of memory.
+char*
+pcget(struct inode *ip, uint pn)
+{
+  struct pcpage **slot, *pg;
+  char *pa;
+
+  if((slot = pcslot(ip, pn, 0)) != 0){
+    acquire(&pcache.lock);
+    if((pg = *slot) != 0){
+      pa = pg->pa;
+      kref(pa);
+      lru_remove(pg);
+      lru_push(pg);
+      release(&pcache.lock);
+      return pa;
+    }
+    release(&pcache.lock);
+  }
+  return pcfill(ip, pn);
+}
+
+// Is page pn of ip in the cache?
+// Caller must hold ip->lock.
+int
+pccached(struct inode *ip, uint pn)
+{
+  struct pcpage **slot;
+  int r;
+
+  if((slot = pcslot(ip, pn, 0)) == 0)
+    return 0;
+  acquire(&pcache.lock);
+  r = *slot != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Copy n bytes written to ip at off, all within one page,
+// into the cached page, if there is one.
+// Caller must hold ip->lock.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage **slot;
+
+  if((slot = pcslot(ip, off / PGSIZE, 0)) == 0)
+    return;
+  acquire(&pcache.lock);
+  if(*slot)
+    memmove((*slot)->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Free the nodes of a subtree of height h, and its pages.
+// Caller must hold pcache.lock.
+static void
+pcfree(struct pcnode *n, int h)
+{
+  for(int i = 0; i < PCFANOUT; i++){
+    if(n->slot[i] == 0)
+      continue;
+    if(h > 1)
+      pcfree(n->slot[i], h - 1);
+    else
+      pcpagefree(n->slot[i]);
+  }
+  kmem_cache_free(pcache.nodes, n);
+}
+
+// Drop all of ip's cached pages, because its data is being
+// freed or its in-memory inode recycled. Caller must hold
+// ip->lock, or be the only user of ip.
+void
+pcdrop(struct inode *ip)
+{
+  if(ip->pcroot == 0)
+    return;
+  acquire(&pcache.lock);
+  pcfree(ip->pcroot, ip->pcheight);
+  release(&pcache.lock);
+  ip->pcroot = 0;
+  ip->pcheight = 0;
+}
+
+// Free up to PCRECLAIM of the least recently used pages
+// that no one has pinned, for kalloc() when memory runs out.
+// Returns the number of pages freed.
+int
+pcreclaim(void)
+{
+  struct pcpage *pg, *prev;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.lru.prev; pg != &pcache.lru && n < PCRECLAIM; pg = prev){
+    prev = pg->prev;
+    if(krefcount(pg->pa) == 1){
+      pcpagefree(pg);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
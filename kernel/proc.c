@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
 
 struct cpu cpus[NCPU];
 
@@ -15,12 +16,16 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+int nproc;    // number of procs that are not UNUSED
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+extern uint asidmax; // highest ASID; see kvminithart().
+
 // initialize the proc table at boot time.
 void
 procinit(void)
@@ -28,6 +33,10 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  for(int i = 0; i < NCPU; i++){
+    cpus[i].asidgen = 1;
+    cpus[i].nextasid = 1;
+  }
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
 
@@ -54,6 +63,61 @@ cpuid()
   return id;
 }
 
+// Return the satp value that runs p's page table on this cpu.
+// A process gets an ASID on a cpu the first time it runs there
+// in that cpu's current generation. ASIDs are never reused
+// within a generation, so a fresh one has no stale TLB entries;
+// when a cpu runs out, it starts a new generation and flushes
+// its whole TLB. ASID 0 belongs to the kernel page table.
+// Must be called with interrupts disabled.
+uint64
+proc_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct procasid *a = &p->asid[cpuid()];
+
+  if(asidmax == 0){
+    // no ASIDs; flush on every switch.
+    sfence_vma();
+    return MAKE_SATP(p->pagetable);
+  }
+  if(a->gen != c->asidgen){
+    if(c->nextasid > asidmax){
+      c->asidgen++;
+      c->nextasid = 1;
+      sfence_vma();
+    }
+    a->asid = c->nextasid++;
+    a->gen = c->asidgen;
+    // order earlier page-table stores before the
+    // hardware walks the table under this ASID.
+    sfence_vma_asid(a->asid);
+  }
+  return MAKE_SATP_ASID(p->pagetable, a->asid);
+}
+
+// Discard TLB entries for p's page table, after a change
+// to it. Flushes p's ASID on this cpu, or the whole TLB if
+// the cpu has no ASIDs, and makes p take a fresh ASID on any
+// other cpu it later runs on.
+// p must be the current process, or not running.
+void
+proc_tlbflush(struct proc *p)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  for(int i = 0; i < NCPU; i++)
+    if(i != id)
+      p->asid[i].gen = 0;
+  if(asidmax == 0)
+    sfence_vma();   // no ASIDs, so p's entries may be anyone's.
+  else if(p->asid[id].gen == mycpu()->asidgen)
+    sfence_vma_asid(p->asid[id].asid);
+  pop_off();
+}
+
 // Return this CPU's cpu struct.
 // Interrupts must be disabled.
 struct cpu*
@@ -112,6 +176,7 @@ found:
     release(&p->lock);
     return 0;
   }
+  __sync_fetch_and_add(&nproc, 1);
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
@@ -127,6 +192,7 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  p->state = USED;
   return p;
 }
 
@@ -140,20 +206,27 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p, p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->rss = 0;
+  p->swaphand = 0;
+  p->nilock = 0;
+  p->kfn = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  memset(p->asid, 0, sizeof(p->asid));
   p->state = UNUSED;
+  __sync_fetch_and_sub(&nproc, 1);
 }
 
 // Create a user page table for a given process,
-// with no user memory, but with trampoline pages.
+// with no user memory, but with the kernel, trampoline
+// pages and p's kernel stack.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
@@ -164,12 +237,20 @@ proc_pagetable(struct proc *p)
   if(pagetable == 0)
     return 0;
 
+  // map the kernel above MAXUVA.
+  if(uvmkmap(pagetable) < 0){
+    uvmkunmap(pagetable);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   // map the trampoline code (for system call return)
   // at the highest user virtual address.
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
+              (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0){
+    uvmkunmap(pagetable);
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -178,6 +259,17 @@ proc_pagetable(struct proc *p)
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmkunmap(pagetable);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
+  // map p's kernel stack where the kernel page table has it.
+  if(mappages(pagetable, p->kstack, PGSIZE,
+              kvmpa(p->kstack), PTE_R | PTE_W) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmkunmap(pagetable);
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -188,10 +280,12 @@ proc_pagetable(struct proc *p)
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(struct proc *p, pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, p->kstack, 1, 0);
+  uvmkunmap(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -220,6 +314,7 @@ userinit(void)
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  p->rss = 1;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -233,21 +328,63 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel thread starts here, as a process starts in forkret().
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread: a process that runs fn, which must
+// never return, in the kernel, and has no user memory.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; the pages are allocated
+// when first touched (see vmfault()).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if((uint64)-n > sz)
+      return -1;
+    if(PGROUNDUP(sz + n) < PGROUNDUP(sz)){
+      // a megapage shared with a child can't be zeroed
+      // in place; it must be split, or the shrink fails.
+      if(uvmsplitshared(p->pagetable, PGROUNDUP(sz + n)) < 0 ||
+         uvmsplitshared(p->pagetable, PGROUNDUP(sz)) < 0)
+        return -1;
+      int npages = (PGROUNDUP(sz) - PGROUNDUP(sz + n)) / PGSIZE;
+      p->rss -= uvmunmap(p->pagetable, PGROUNDUP(sz + n), npages, 1);
+      proc_tlbflush(p);
+    }
+    sz += n;
   }
   p->sz = sz;
   return 0;
@@ -274,6 +411,13 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(mmapfork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->rss = p->rss;
+  proc_tlbflush(p);   // parent's pages are now copy-on-write.
 
   np->parent = p;
 
@@ -300,6 +444,48 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program path with
+// arguments argv, as fork() and then exec() would, but
+// without copying the caller's memory only to throw it
+// away. The child's file descriptor i is files[i], for
+// i < nfiles; it has none where files[i] is 0.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **files, int nfiles)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // np is USED, so no one else will take it; don't hold
+  // np->lock while loading the program, which sleeps.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < nfiles; i++)
+    if(files[i])
+      np->ofile[i] = filedup(files[i]);
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+  acquire(&np->lock);
+  np->parent = p;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -337,6 +523,10 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap files, writing back shared pages, while
+  // they are still open.
+  mmapexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -401,6 +591,11 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the copyout() below runs under spinlocks, where a fault
+  // can't sleep to read a page in; see uvmprefault().
+  if(addr != 0)
+    uvmprefault(p, addr, sizeof(int));
+
   // hold p->lock for the whole time to avoid lost
   // wakeups from a child's exit().
   acquire(&p->lock);
@@ -473,7 +668,11 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        // the process's page table maps the kernel, and its
+        // kernel stack, so switch to it before swtch().
+        w_satp(proc_satp(p));
         swtch(&c->context, &p->context);
+        kvmswitch();
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
@@ -483,7 +682,8 @@ scheduler(void)
       }
       release(&p->lock);
     }
-    if(found == 0) {
+    if(found == 0 && kzero_idle() == 0) {
+      // nothing to run and no pages to zero.
       intr_on();
       asm volatile("wfi");
     }
@@ -673,6 +873,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
@@ -689,7 +890,16 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s rss %d", p->pid, state, p->name, p->rss);
     printf("\n");
   }
 }
+
+// Report the process count, and the calling process's
+// resident pages, for sysinfo().
+void
+procinfo(struct sysinfo *info)
+{
+  info->nproc = nproc;
+  info->rss = myproc()->rss;
+}
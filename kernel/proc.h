@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // Current ASID generation on this cpu.
+  uint nextasid;              // Next ASID to hand out in this generation.
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,15 +36,16 @@ extern struct cpu cpus[NCPU];
 // the sscratch register points here.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
-// kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
+// kernel_sp, kernel_hartid, and jumps to kernel_trap.
 // usertrapret() and userret in trampoline.S set up
 // the trapframe's kernel_*, restore user registers from the
-// trapframe, switch to the user page table, and enter user space.
+// trapframe, and enter user space. the user page table maps
+// the kernel too, so neither switches page tables.
 // the trapframe includes callee-saved user registers like s0-s11 because the
 // return-to-user path via usertrapret() doesn't return through
 // the entire kernel call stack.
 struct trapframe {
-  /*   0 */ uint64 kernel_satp;   // kernel page table
+  /*   0 */ uint64 kernel_satp;   // unused
   /*   8 */ uint64 kernel_sp;     // top of process's kernel stack
   /*  16 */ uint64 kernel_trap;   // usertrap()
   /*  24 */ uint64 epc;           // saved user program counter
@@ -80,7 +83,36 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// A process's ASID on one cpu; valid if gen
+// matches that cpu's asidgen.
+struct procasid {
+  uint asid;
+  uint64 gen;
+};
+
+// A memory-mapped region of a file or of a shared-memory
+// segment, or a segment of the program; see mmap.c.
+// Unused if both file and shm are 0.
+struct vma {
+  uint64 addr;        // first mapped address, page-aligned
+  uint64 len;         // bytes, a multiple of PGSIZE
+  int prot;           // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;          // MAP_SHARED or MAP_PRIVATE, and VMA_TEXT
+  struct file *file;  // mapped file, or 0
+  struct shm *shm;    // mapped segment, or 0
+  uint64 off;         // file offset of addr
+  uint64 dataend;     // file data ends here; zeros above
+};
+
+// vma flag: a program segment loaded by exec(), below p->sz.
+#define VMA_TEXT 0x100
+
+// returned by vmfault1() and the functions that fill pages
+// for it when memory runs out, where -1 means the access is
+// illegal or can't be served now; vmfault() swaps and retries.
+#define FAULT_NOMEM (-2)
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
@@ -97,10 +129,16 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 rss;                  // Number of user pages mapped
+  uint64 swaphand;             // Where swapout() looks next
+  struct procasid asid[NCPU];  // ASID on each cpu; see proc_satp()
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // Memory-mapped files
   struct inode *cwd;           // Current directory
+  int nilock;                  // Inode locks held; see vmafill()
+  void (*kfn)(void);           // Kernel thread's function, or 0
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,131 @@
+// Shared-memory segments.
+//
+// A segment is a set of pages named by an integer key. Every
+// process that attaches it with shmat() maps the same physical
+// pages, so processes can exchange data without the kernel
+// copying it. Pages are allocated, zeroed, when first touched.
+//
+// Each attachment, including one inherited through fork(),
+// holds a reference to the segment; the segment's pages and
+// its slot are freed when the last attachment goes away.
+// The segment also holds a kref() on each of its pages, and
+// each mapping of a page one more, so a page outlives the
+// segment until the last process unmaps it.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+// pages[] is one page of physical addresses.
+#define SHMMAXPAGES (PGSIZE / sizeof(char*))
+
+struct shm {
+  int key;
+  int ref;        // attachments; 0 if the slot is free
+  uint npages;
+  char **pages;   // physical pages, or 0 if not yet touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Find the segment with the given key and take a reference
+// to it, or create it with npages pages if there is none.
+// Returns 0 if the segment is smaller than npages, or if
+// there is no room for a new one.
+struct shm*
+shmget(int key, uint npages)
+{
+  struct shm *s, *free = 0;
+
+  if(npages == 0 || npages > SHMMAXPAGES)
+    return 0;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->ref > 0 && s->key == key){
+      if(npages > s->npages){
+        release(&shmtab.lock);
+        return 0;
+      }
+      s->ref++;
+      release(&shmtab.lock);
+      return s;
+    }
+    if(s->ref == 0 && free == 0)
+      free = s;
+  }
+  if(free == 0 || (free->pages = kalloc_zeroed()) == 0){
+    release(&shmtab.lock);
+    return 0;
+  }
+  free->key = key;
+  free->npages = npages;
+  free->ref = 1;
+  release(&shmtab.lock);
+  return free;
+}
+
+// Take another reference to s, for fork().
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it with the last one.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0){
+    for(int i = 0; i < s->npages; i++)
+      if(s->pages[i])
+        kfree(s->pages[i]);
+    kfree(s->pages);
+    s->pages = 0;
+  }
+  release(&shmtab.lock);
+}
+
+// Size of s in bytes.
+uint64
+shmsize(struct shm *s)
+{
+  return (uint64)s->npages * PGSIZE;
+}
+
+// Page i of s, allocated if this is its first use, with
+// a reference for the caller's mapping. Returns 0 if out
+// of memory.
+char*
+shmpage(struct shm *s, uint i)
+{
+  char *pa;
+
+  acquire(&shmtab.lock);
+  if(i >= s->npages)
+    panic("shmpage");
+  if(s->pages[i] == 0)
+    s->pages[i] = kalloc_zeroed();
+  if((pa = s->pages[i]) != 0)
+    kref(pa);
+  release(&shmtab.lock);
+  return pa;
+}
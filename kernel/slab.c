@@ -0,0 +1,284 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A kmem_cache hands out objects of one size, carved out of
+// whole pages ("slabs") from kalloc(). Each slab starts with a
+// struct slab header; the objects follow. An object's slab is
+// found by rounding its address down to a page boundary.
+//
+// Each CPU keeps a small "magazine" of free objects per cache,
+// so most allocations and frees touch neither the cache lock
+// nor the slab lists. The optional constructor runs once, when
+// an object is first carved out of a new slab; objects should
+// be returned to the cache in their constructed state.
+//
+// kmalloc() and kmfree() are built on a set of caches for
+// power-of-two sizes up to KMALLOC_MAX bytes.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE   24   // maximum number of caches
+#define MAGSIZE  16   // objects per per-CPU magazine
+
+// per-CPU stack of free objects.
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;                 // object size in bytes
+  uint perslab;              // objects per slab
+  void (*ctor)(void*);       // object constructor, or 0
+  struct slab *partial;      // slabs with free objects
+  int nslab;                 // number of slabs
+  uint nalloc;               // allocations that missed the magazine
+  struct magazine mag[NCPU];
+};
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;     // cache's list of slabs with free objects
+  void *free;            // free objects in this slab
+  int inuse;             // number of objects handed out
+  int onlist;            // is this slab on cache->partial?
+};
+
+// objects start here within a slab page.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct obj {
+  struct obj *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+#define NKMALLOC 8      // kmalloc caches: 16, 32, ..., 2048 bytes
+#define KMALLOC_MAX (16 << (NKMALLOC-1))
+static struct kmem_cache *kmalloc_cache[NKMALLOC];
+static char *kmalloc_name[NKMALLOC] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+  for(int i = 0; i < NKMALLOC; i++)
+    kmalloc_cache[i] = kmem_cache_create(kmalloc_name[i], 16 << i, 0);
+}
+
+// Create a cache of objects of the given size.
+// ctor, if not 0, initializes each new object.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct obj))
+    size = sizeof(struct obj);
+  if(size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: too big");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NCACHE)
+    panic("kmem_cache_create: no caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->ctor = ctor;
+  c->partial = 0;
+  c->nslab = 0;
+  c->nalloc = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+  return c;
+}
+
+// Carve a new slab into constructed objects.
+// Called without c->lock, since the constructor
+// might want to take locks of its own.
+static struct slab*
+newslab(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->next = 0;
+  s->free = 0;
+  s->inuse = 0;
+  s->onlist = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*c->size;
+    if(c->ctor)
+      c->ctor(o);
+    ((struct obj*)o)->next = s->free;
+    s->free = o;
+  }
+  return s;
+}
+
+// Take an object off one of c's slabs.
+// Caller must hold c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s = c->partial;
+  struct obj *o;
+
+  if(s == 0)
+    return 0;
+  o = s->free;
+  s->free = o->next;
+  s->inuse++;
+  if(s->free == 0){
+    // slab is now full; drop it from the partial list.
+    c->partial = s->next;
+    s->onlist = 0;
+  }
+  return o;
+}
+
+// Return an object to its slab, and the slab to
+// kalloc() if it is empty and not the only one.
+// Returns 1 if the slab went back to kalloc(), else 0.
+// Caller must hold c->lock.
+static int
+slab_put(struct kmem_cache *c, void *p)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)p);
+  struct obj *o = p;
+
+  if(s->cache != c)
+    panic("slab_put");
+  o->next = s->free;
+  s->free = o;
+  s->inuse--;
+  if(!s->onlist){
+    s->next = c->partial;
+    c->partial = s;
+    s->onlist = 1;
+  }
+  if(s->inuse == 0 && c->nslab > 1){
+    struct slab **pp;
+    for(pp = &c->partial; *pp != s; pp = &(*pp)->next)
+      ;
+    *pp = s->next;
+    c->nslab--;
+    kfree(s);
+    return 1;
+  }
+  return 0;
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  struct slab *s;
+  void *p;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n > 0){
+    p = m->obj[--m->n];
+    pop_off();
+    return p;
+  }
+
+  acquire(&c->lock);
+  if(c->partial == 0){
+    release(&c->lock);
+    if((s = newslab(c)) == 0){
+      pop_off();
+      return 0;
+    }
+    acquire(&c->lock);
+    s->next = c->partial;
+    c->partial = s;
+    s->onlist = 1;
+    c->nslab++;
+  }
+  p = slab_get(c);
+  // refill half of the magazine while we hold the lock.
+  while(m->n < MAGSIZE/2 && c->partial)
+    m->obj[m->n++] = slab_get(c);
+  c->nalloc++;
+  release(&c->lock);
+  pop_off();
+  return p;
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *p)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n >= MAGSIZE){
+    // magazine full; give half of it back to the slabs.
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = p;
+  pop_off();
+}
+
+// Return an object to cache c straight to its slab, not to
+// this CPU's magazine, so that an empty slab goes back to
+// kalloc() now. For callers freeing objects to give memory
+// back. Returns the number of pages freed, 0 or 1.
+int
+kmem_cache_release(struct kmem_cache *c, void *p)
+{
+  int n;
+
+  acquire(&c->lock);
+  n = slab_put(c, p);
+  release(&c->lock);
+  return n;
+}
+
+// Allocate n bytes of kernel memory, n <= KMALLOC_MAX.
+// Returns 0 if out of memory.
+void*
+kmalloc(uint n)
+{
+  if(n > KMALLOC_MAX)
+    panic("kmalloc: too big");
+  for(int i = 0; ; i++)
+    if(n <= (16 << i))
+      return kmem_cache_alloc(kmalloc_cache[i]);
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *p)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)p);
+  kmem_cache_free(s->cache, p);
+}
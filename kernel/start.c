@@ -6,6 +6,7 @@
 
 void main();
 void timerinit();
+void probe();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
@@ -16,10 +17,29 @@ uint64 mscratch0[NCPU * 32];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+// kernelvec.S: machine-mode trap vector for probe().
+extern void probevec();
+
+// what probe() finds, for string.c.
+extern int memvec;
+extern int cbozero_size;
+
+// a page for probe() to find the cbo.zero block size with.
+__attribute__ ((aligned (4096))) static char probepage[4096];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
 {
+  // look for optional instructions, before anything
+  // else uses mtvec or mstatus.MPP.
+  probe();
+
+#ifdef MEMBENCH
+  // let supervisor mode read the cycle counter.
+  w_mcounteren(r_mcounteren() | 1);
+#endif
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -81,3 +101,40 @@ timerinit()
   // enable machine-mode timer interrupts.
   w_mie(r_mie() | MIE_MTIE);
 }
+
+// probe for optional memory instructions. QEMU's virt machine
+// can provide the vector extension and Zicboz (cbo.zero).
+// string.c falls back to scalar code for what isn't there.
+void
+probe()
+{
+  register uint64 a0 asm("a0");
+  int i;
+
+  // catch illegal-instruction traps.
+  w_mtvec((uint64)probevec);
+
+  if(r_misa() & MISA_V)
+    memvec = 1;
+
+  // let supervisor mode use cbo.zero. menvcfg is per-CPU,
+  // and an older CPU without it traps.
+  a0 = 0;
+  asm volatile("csrs 0x30a, %1" : "+r" (a0) : "r" (MENVCFG_CBZE) : "t0");
+  if(a0 != 0 || r_mhartid() != 0)
+    return;
+
+  // find the block size by zeroing the first block of
+  // a page of ones.
+  for(i = 0; i < PGSIZE; i++)
+    probepage[i] = 1;
+  a0 = 0;
+  asm volatile(".insn i 0x0f, 2, x0, %1, 4"   // cbo.zero (%1)
+               : "+r" (a0) : "r" (probepage) : "t0", "memory");
+  if(a0 != 0)
+    return;
+  for(i = 0; i < PGSIZE && probepage[i] == 0; i++)
+    ;
+  if(i >= 8 && (i & (i-1)) == 0)
+    cbozero_size = i;
+}
@@ -1,52 +1,98 @@
 #include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+#include "wordops.h"
+
+// set by probe() in start.c.
+int memvec;          // use the vector extension for long operations
+int cbozero_size;    // cbo.zero block size, or 0 if no cbo.zero
+
+// below this many bytes, the vector setup isn't worth it.
+#define VECMIN 256
+
+// vecops.S
+void vec_memmove(void*, const void*, uint64);
+void vec_memset(void*, int, uint64);
+uint64 vec_memcmp(const void*, const void*, uint64);
+
+// vector registers aren't saved by swtch(), so keep
+// interrupts off while using them, and the unit off
+// the rest of the time.
+static void
+vecbegin(void)
+{
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INIT);
+}
+
+static void
+vecend(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  if(memvec && n >= VECMIN){
+    vecbegin();
+    vec_memset(dst, c, n);
+    vecend();
+  } else
+    wmemset(dst, c, n);
   return dst;
 }
 
 int
 memcmp(const void *v1, const void *v2, uint n)
 {
-  const uchar *s1, *s2;
-
-  s1 = v1;
-  s2 = v2;
-  while(n-- > 0){
-    if(*s1 != *s2)
-      return *s1 - *s2;
-    s1++, s2++;
+  const uchar *s1 = v1, *s2 = v2;
+  uint64 i;
+
+  if(memvec && n >= VECMIN){
+    vecbegin();
+    i = vec_memcmp(v1, v2, n);
+    vecend();
+    if(i == n)
+      return 0;
+    return s1[i] - s2[i];
   }
-
-  return 0;
+  return wmemcmp(v1, v2, n);
 }
 
 void*
 memmove(void *dst, const void *src, uint n)
 {
-  const char *s;
-  char *d;
-
-  s = src;
-  d = dst;
-  if(s < d && s + n > d){
-    s += n;
-    d += n;
-    while(n-- > 0)
-      *--d = *--s;
+  const char *s = src;
+  char *d = dst;
+
+  // vec_memmove() only copies forward.
+  if(memvec && n >= VECMIN && !(s < d && s + n > d)){
+    vecbegin();
+    vec_memmove(dst, src, n);
+    vecend();
   } else
-    while(n-- > 0)
-      *d++ = *s++;
-
+    wmemmove(dst, src, n);
   return dst;
 }
 
+// Zero sz bytes of page-aligned memory at pa, sz a
+// multiple of PGSIZE, with cbo.zero if the CPU has it.
+void
+pagezero(void *pa, uint64 sz)
+{
+  char *p;
+
+  if(cbozero_size == 0){
+    memset(pa, 0, sz);
+    return;
+  }
+  for(p = pa; p < (char*)pa + sz; p += cbozero_size)
+    asm volatile(".insn i 0x0f, 2, x0, %0, 4" : : "r" (p) : "memory"); // cbo.zero (p)
+}
+
 // memcpy exists to placate GCC.  Use memmove.
 void*
 memcpy(void *dst, const void *src, uint n)
@@ -95,10 +141,57 @@ safestrcpy(char *s, const char *t, int n)
 int
 strlen(const char *s)
 {
-  int n;
+  return wstrlen(s);
+}
 
-  for(n = 0; s[n]; n++)
-    ;
-  return n;
+
+#ifdef MEMBENCH
+#define NBENCH 64
+
+static void
+benchprint(char *what, char *how, uint64 bytes, uint64 cycles)
+{
+  uint64 x = bytes * 100 / (cycles ? cycles : 1);
+
+  printf("membench: %s %s: %d.%d%d bytes/cycle\n", what, how,
+         (int)(x / 100), (int)(x / 10 % 10), (int)(x % 10));
 }
 
+// Measure page zeroing and 1 KB copies with each of
+// the implementations this CPU has. Run at boot, with
+// make MEMBENCH=1.
+void
+membench(void)
+{
+  static char *how[] = { "scalar", "vector", "cbo.zero" };
+  int vec = memvec, cbo = cbozero_size;
+  char *a, *b;
+  uint64 t;
+
+  if((a = kalloc()) == 0 || (b = kalloc()) == 0)
+    panic("membench");
+  for(int m = 0; m < 3; m++){
+    if((m == 1 && !vec) || (m == 2 && !cbo))
+      continue;
+    memvec = (m == 1) ? vec : 0;
+    cbozero_size = (m == 2) ? cbo : 0;
+
+    t = r_cycle();
+    for(int i = 0; i < NBENCH; i++)
+      pagezero(a, PGSIZE);
+    benchprint("page zero", how[m], NBENCH * PGSIZE, r_cycle() - t);
+
+    if(m == 2)
+      continue;
+    t = r_cycle();
+    for(int i = 0; i < NBENCH; i++)
+      for(int off = 0; off < PGSIZE; off += 1024)
+        memmove(b + off, a + off, 1024);
+    benchprint("1KB copy", how[m], NBENCH * PGSIZE, r_cycle() - t);
+  }
+  memvec = vec;
+  cbozero_size = cbo;
+  kfree(a);
+  kfree(b);
+}
+#endif
@@ -0,0 +1,185 @@
+// Swap.
+//
+// When memory runs out, vmfault() has the faulting process
+// swap out one of its own pages that hasn't been used lately:
+// swapout() writes the page to the swap disk (virtio disk 1),
+// frees it, and leaves an invalid PTE marked PTE_SWAP that
+// holds the page's swap slot and permissions. The next touch
+// of the page faults, and vmfault() reads it back with swapin().
+//
+// swapout() picks the page with a clock sweep over the process's
+// pages below p->sz, starting where the last sweep stopped: a
+// page with its accessed bit (PTE_A) set gets the bit cleared
+// and a second chance, and the first page found with the bit
+// clear is written out. Only pages no one else maps are taken,
+// which leaves out shared memory, cached program text and pages
+// still shared copy-on-write after fork(); megapages are left
+// alone too. A process only swaps out its own pages, since
+// nothing but the owning process changes a page table, and
+// xv6 has no lock to stop it doing so meanwhile.
+//
+// fork() copies a swapped-out PTE, giving the slot another
+// reference; each process then swaps in its own copy.
+// Swapping sleeps, so it isn't done for a fault the kernel
+// takes while holding a spinlock; see uvmprefault().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SWAPDISK    1
+#define REFORDER    3                      // ref[] is 2^REFORDER pages
+#define MAXSLOT     (PGSIZE << REFORDER)   // a byte of ref[] per slot
+
+struct {
+  struct spinlock lock;
+  uint nslot;    // 0 if there is no swap disk
+  uint next;     // where to start looking for a free slot
+  uint nused;
+  uchar *ref;    // references to each slot; 0 if it's free
+} swap;
+
+void
+swapinit(void)
+{
+  uint64 n;
+
+  initlock(&swap.lock, "swap");
+  if((n = virtio_disk_size(SWAPDISK) / PGSIZE) == 0)
+    return;
+  if(n > MAXSLOT)
+    n = MAXSLOT;
+  if((swap.ref = kalloc_pages(REFORDER)) == 0)
+    panic("swapinit");
+  memset(swap.ref, 0, MAXSLOT);
+  swap.nslot = n;
+}
+
+// Allocate a swap slot. Returns -1 if swap is full.
+static int
+slotalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      swap.nused++;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Take another reference to slot, for fork().
+// Returns -1 if the slot has too many already.
+int
+swapdup(uint64 slot)
+{
+  int r = -1;
+
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  if(swap.ref[slot] < 255){
+    swap.ref[slot]++;
+    r = 0;
+  }
+  release(&swap.lock);
+  return r;
+}
+
+// Drop a reference to slot, freeing it with the last.
+void
+swapfree(uint64 slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Write one of p's pages that hasn't been used lately to
+// swap, and free it. p must be the current process.
+// Returns 0 on success, -1 if there's nothing to swap out,
+// no room in swap, or no swap disk.
+int
+swapout(struct proc *p)
+{
+  uint64 a, sz, pa, npages;
+  pte_t *pte;
+  int slot, flags, cleared = 0;
+
+  if(swap.nslot == 0 || !cansleep())
+    return -1;
+
+  // two trips round, in case the first only clears PTE_A.
+  npages = PGROUNDUP(p->sz) / PGSIZE;
+  for(uint64 i = 0; i < 2*npages; i++){
+    a = p->swaphand;
+    p->swaphand = a + PGSIZE < p->sz ? a + PGSIZE : 0;
+    if((pte = walkleaf(p->pagetable, a, &sz)) == 0 || sz != PGSIZE)
+      continue;
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    pa = PTE2PA(*pte);
+    if(krefcount((void*)pa) != 1)
+      continue;
+    if(*pte & PTE_A){
+      // recently used: a second chance.
+      *pte &= ~PTE_A;
+      cleared = 1;
+      continue;
+    }
+
+    if((slot = slotalloc()) < 0)
+      break;
+    // p is here, not changing its page table, while
+    // this sleeps.
+    virtio_disk_rwpage(SWAPDISK, slot, (void*)pa, 1);
+    flags = PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U);
+    if(*pte & PTE_COW)
+      flags |= PTE_W;   // no one else has it now.
+    *pte = SLOT2PTE(slot) | flags | PTE_SWAP;
+    proc_tlbflush(p);
+    kfree((void*)pa);
+    p->rss--;
+    return 0;
+  }
+  // so that the hardware sets PTE_A again.
+  if(cleared)
+    proc_tlbflush(p);
+  return -1;
+}
+
+// Read p's swapped-out page, whose PTE is pte, back in.
+// Returns 0 on success, FAULT_NOMEM if out of memory,
+// or -1 if the caller can't sleep.
+int
+swapin(struct proc *p, pte_t *pte)
+{
+  uint64 slot = PTE2SLOT(*pte);
+  char *mem;
+
+  if(!cansleep())
+    return -1;
+  if((mem = kalloc()) == 0)
+    return FAULT_NOMEM;
+  virtio_disk_rwpage(SWAPDISK, slot, mem, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  p->rss++;
+  proc_tlbflush(p);
+  return 0;
+}
@@ -20,3 +20,10 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_sysinfo 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_shmat  25
+#define SYS_shmdt  26
+#define SYS_spawn  27
+#define SYS_fsync  28
@@ -115,6 +115,19 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until the file system updates of all system calls
+// that have returned, fd's among them, are on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -257,9 +270,16 @@ create(char *path, short type, short major, short minor)
     iunlockput(ip);
     return 0;
   }
+  if(dirinum(dp, name, 0) != 0){
+    // it exists, but there was no memory for its inode.
+    iunlockput(dp);
+    return 0;
+  }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -412,23 +432,23 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the argument vector at user address uargv into
+// argv[MAXARG], a page for each string.
+// Returns 0 on success, -1 on failure; either way,
+// the caller must call freeargv().
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -436,22 +456,75 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds) runs path in a new process.
+// fds, if not 0, points to the caller's descriptors to
+// give the child as its 0, 1 and 2 (-1 for none), and
+// the child gets no others; if fds is 0, the child
+// inherits all of the caller's descriptors.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv, ufds;
+  int fds[3], i, ret;
+  struct file *files[3];
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufds) < 0)
+    return -1;
+  if(ufds != 0){
+    if(copyin(p->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+      return -1;
+    for(i = 0; i < 3; i++){
+      files[i] = 0;
+      if(fds[i] == -1)
+        continue;
+      if(fds[i] < 0 || fds[i] >= NOFILE || (files[i] = p->ofile[fds[i]]) == 0)
+        return -1;
+    }
+  }
+
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0){
+    if(ufds != 0)
+      ret = spawn(path, argv, files, 3);
+    else
+      ret = spawn(path, argv, p->ofile, NOFILE);
+  }
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -484,3 +557,32 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// addr is only a hint, and is ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  return mmap(myproc(), len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(len <= 0)
+    return -1;
+  return munmap(myproc(), addr, len);
+}
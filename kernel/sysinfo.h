@@ -0,0 +1,13 @@
+// System-wide memory accounting, returned by sysinfo().
+struct sysinfo {
+  uint64 freemem;     // bytes of free physical memory
+  uint64 nproc;       // number of processes that are not UNUSED
+  uint64 ptpages;     // pages holding page tables
+  uint64 superpages;  // megapage mappings in user page tables
+  uint64 nbuf;        // buffers in the buffer cache
+  uint64 nbufbusy;    // buffers in use (refcnt > 0)
+  uint64 nbufhit;     // buffer cache lookups that found their block
+  uint64 nbufmiss;    // and that had to read or allocate it
+  uint64 nlogcommit;  // file system log transactions committed
+  uint64 rss;         // resident pages of the calling process
+};
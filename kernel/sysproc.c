@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 uint64
 sys_exit(void)
@@ -95,3 +96,47 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// return memory and process accounting;
+// see kernel/sysinfo.h.
+uint64
+sys_sysinfo(void)
+{
+  struct sysinfo info;
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  kallocinfo(&info);
+  vminfo(&info);
+  binfo(&info);
+  loginfo(&info);
+  procinfo(&info);
+  if(copyout(myproc()->pagetable, addr, (char *)&info, sizeof(info)) < 0)
+    return -1;
+  return 0;
+}
+
+// attach the shared-memory segment named by key,
+// creating it with size bytes if it doesn't exist.
+uint64
+sys_shmat(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  if(size <= 0)
+    return -1;
+  return shmat(myproc(), key, size);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return shmdt(myproc(), addr);
+}
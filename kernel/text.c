@@ -0,0 +1,194 @@
+// Program text cache.
+//
+// exec() reads a program's ELF header and program headers
+// once, into a struct text hung off the program's inode, and
+// maps the pages of its read-only segments shared between all
+// the processes that run it: vmafill() asks textpage() for a
+// page, which is read from the file only the first time any
+// process touches it. So memory for program text grows with
+// the number of distinct programs, not of processes, and a
+// program run again needs no disk reads for its text.
+//
+// The cache holds a kref() on each of its pages, and each
+// mapping one more. Writing or truncating the file, or
+// recycling its in-memory inode, drops the cache with
+// textinval(); processes already running the program keep
+// the pages they have mapped. When memory runs out, kalloc()
+// calls textreclaim() to free cached pages no process maps.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "elf.h"
+#include "text.h"
+#include "proc.h"
+#include "defs.h"
+
+// pages[] is one page of physical addresses.
+#define TEXTMAXPAGES (PGSIZE / sizeof(char*))
+
+// the lock protects each inode's ip->text and every
+// text's pages[]; an inode's lock protects the rest.
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct text *list;
+} texts;
+
+void
+textinit(void)
+{
+  initlock(&texts.lock, "text");
+  texts.cache = kmem_cache_create("text", sizeof(struct text), 0);
+}
+
+// Return ip's cached headers, reading them from the file if
+// this is the first exec() of ip since it was last written.
+// Only the loadable segments are kept in ph[].
+// Caller must hold ip->lock.
+// Returns 0 if ip isn't an ELF executable, or out of memory.
+struct text*
+textload(struct inode *ip)
+{
+  struct text *t;
+  struct proghdr ph;
+  int i, off;
+
+  if(ip->text)
+    return ip->text;
+
+  if((t = kmem_cache_alloc(texts.cache)) == 0)
+    return 0;
+  if((t->pages = kalloc_zeroed()) == 0)
+    goto bad;
+  if(readi(ip, 0, (uint64)&t->elf, 0, sizeof(t->elf)) != sizeof(t->elf))
+    goto bad;
+  if(t->elf.magic != ELF_MAGIC)
+    goto bad;
+  t->nph = 0;
+  for(i=0, off=t->elf.phoff; i<t->elf.phnum; i++, off+=sizeof(ph)){
+    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
+      goto bad;
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
+      continue;
+    if(t->nph == NVMA)
+      goto bad;
+    t->ph[t->nph++] = ph;
+  }
+
+  acquire(&texts.lock);
+  t->next = texts.list;
+  texts.list = t;
+  ip->text = t;
+  release(&texts.lock);
+  return t;
+
+ bad:
+  if(t->pages)
+    kfree(t->pages);
+  kmem_cache_free(texts.cache, t);
+  return 0;
+}
+
+// Set *memp to the page of ip's program at va, holding n
+// bytes of the file from offset off and zeros after them,
+// with a kref() for the caller's mapping. The page is shared
+// with every process that runs ip: it comes from the cache,
+// or if sleepok is set, is read from the file and added to it.
+// Returns 0 on success, FAULT_NOMEM if out of memory, or -1
+// if the page isn't cached and can't be read.
+int
+textpage(struct inode *ip, uint64 va, uint off, uint n, int sleepok, char **memp)
+{
+  struct text *t;
+  uint64 i = va / PGSIZE;
+  char *mem;
+
+  acquire(&texts.lock);
+  if((t = ip->text) != 0 && i < TEXTMAXPAGES && (mem = t->pages[i]) != 0){
+    kref(mem);
+    release(&texts.lock);
+    *memp = mem;
+    return 0;
+  }
+  release(&texts.lock);
+
+  if(!sleepok)
+    return -1;
+  if((mem = kalloc_zeroed()) == 0)
+    return FAULT_NOMEM;
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return -1;
+  }
+  // holding ip->lock, so ip->text can't have been
+  // replaced since the file was read.
+  acquire(&texts.lock);
+  if((t = ip->text) != 0 && i < TEXTMAXPAGES){
+    if(t->pages[i]){
+      // another process read it first.
+      kfree(mem);
+      mem = t->pages[i];
+    } else {
+      t->pages[i] = mem;
+    }
+    kref(mem);
+  }
+  release(&texts.lock);
+  iunlock(ip);
+  *memp = mem;
+  return 0;
+}
+
+// Drop ip's cached text, because the file is changing or
+// its in-memory inode is being recycled. Caller must hold
+// ip->lock, or be the only user of ip.
+void
+textinval(struct inode *ip)
+{
+  struct text *t, **pp;
+
+  acquire(&texts.lock);
+  if((t = ip->text) == 0){
+    release(&texts.lock);
+    return;
+  }
+  ip->text = 0;
+  for(pp = &texts.list; *pp != t; pp = &(*pp)->next)
+    ;
+  *pp = t->next;
+  release(&texts.lock);
+
+  for(int i = 0; i < TEXTMAXPAGES; i++)
+    if(t->pages[i])
+      kfree(t->pages[i]);
+  kfree(t->pages);
+  kmem_cache_free(texts.cache, t);
+}
+
+// Free cached text pages that no process has mapped.
+// Returns the number of pages freed.
+int
+textreclaim(void)
+{
+  int n = 0;
+
+  acquire(&texts.lock);
+  for(struct text *t = texts.list; t; t = t->next){
+    for(int i = 0; i < TEXTMAXPAGES; i++){
+      if(t->pages[i] && krefcount(t->pages[i]) == 1){
+        kfree(t->pages[i]);
+        t->pages[i] = 0;
+        n++;
+      }
+    }
+  }
+  release(&texts.lock);
+  return n;
+}
@@ -0,0 +1,9 @@
+// A program file's cached ELF headers and read-only pages;
+// see text.c. Include after elf.h.
+struct text {
+  struct elfhdr elf;
+  int nph;                   // loadable segments in ph[]
+  struct proghdr ph[NVMA];
+  char **pages;              // read-only pages, by virtual page number
+  struct text *next;         // list of all texts
+};
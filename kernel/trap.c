@@ -11,6 +11,9 @@ uint ticks;
 
 extern char trampoline[], uservec[], userret[];
 
+// uaccess.S
+extern char uaccess_start[], uaccess_end[], uaccess_fault[];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -65,6 +68,18 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault on a lazily-allocated, copy-on-write, mapped
+    // or swapped-out page. vmfault() may sleep for the disk,
+    // so, as for a system call, turn interrupts on.
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+    intr_on();
+    if(vmfault(p, stval, scause == 15) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -101,7 +116,6 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -112,20 +126,17 @@ usertrapret(void)
   // set S Previous Privilege mode to User.
   unsigned long x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
+  x &= ~SSTATUS_SUM; // in case a copyout() was interrupted
   x |= SSTATUS_SPIE; // enable interrupts in user mode
   w_sstatus(x);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
-
   // jump to trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // restores user registers, and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64))fn)(TRAPFRAME);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +154,27 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // a copyin() or copyout() may have user memory access on.
+  // turn it off while handling the trap: yield(), and a
+  // vmfault() that sleeps, switch to other processes, and
+  // swtch() doesn't save sstatus, so they would run with it.
+  // the w_sstatus() at the end restores it.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)uaccess_start && sepc < (uint64)uaccess_end){
+    // page fault on user memory in copyin() or copyout().
+    // retry if vmfault() can fix it, otherwise fail the copy.
+    // vmfault() may sleep for the disk, which it may only do
+    // with interrupts on; turn them back on if the copy ran
+    // with them on (see cansleep()).
+    uint64 stval = r_stval();
+    if(sstatus & SSTATUS_SPIE)
+      intr_on();
+    if(vmfault(myproc(), stval, scause == 15) < 0)
+      sepc = (uint64)uaccess_fault;
+    intr_off();
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -188,7 +219,9 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      virtio_disk_intr(0);
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_disk_intr(1);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
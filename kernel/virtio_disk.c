@@ -1,9 +1,13 @@
 //
-// driver for qemu's virtio disk device.
+// driver for qemu's virtio disk devices.
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+//          -drive file=swap.img,if=none,format=raw,id=x1 -device virtio-blk-device,drive=x1,bus=virtio-mmio-bus.1
+//
+// disk 0 holds the file system; disk 1, which is optional,
+// is swap space (see swap.c).
 //
 
 #include "types.h"
@@ -17,15 +21,16 @@
 #include "buf.h"
 #include "virtio.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of disk d's virtio mmio register r.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
 static struct disk {
+  uint64 base;     // mmio registers
+  int present;
+
  // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+ // two contiguous, page-aligned pages from kalloc_pages().
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
@@ -38,36 +43,43 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // for virtio_disk_start(), or 0
+    char busy;     // is the device working on it?
     char status;
   } info[NUM];
+
+  // the request headers, indexed like info[].
+  struct virtio_blk_outhdr ops[NUM];
   
   struct spinlock vdisk_lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disks[NDISK];
 
-void
-virtio_disk_init(void)
+// Set up disk d at mmio address base. Returns 0 if
+// there is no disk there, 1 if there is.
+static int
+disk_init(struct disk *d, uint64 base)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->base = base;
+  initlock(&d->vdisk_lock, "virtio_disk");
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 1 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 1 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return 0;
   }
   
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
@@ -75,50 +87,78 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
-  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+  *R(d, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
   // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = 0;
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
   if(max < NUM)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  if((d->pages = kalloc_pages(1)) == 0)
+    panic("virtio disk kalloc_pages");
+  memset(d->pages, 0, 2*PGSIZE);
+  *R(d, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)d->pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
   // avail = pages + 0x40 -- 2 * uint16, then num * uint16
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
-  disk.desc = (struct VRingDesc *) disk.pages;
-  disk.avail = (uint16*)(((char*)disk.desc) + NUM*sizeof(struct VRingDesc));
-  disk.used = (struct UsedArea *) (disk.pages + PGSIZE);
+  d->desc = (struct VRingDesc *) d->pages;
+  d->avail = (uint16*)(((char*)d->desc) + NUM*sizeof(struct VRingDesc));
+  d->used = (struct UsedArea *) (d->pages + PGSIZE);
 
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    d->free[i] = 1;
+
+  d->present = 1;
+  return 1;
+}
+
+void
+virtio_disk_init(void)
+{
+  if(!disk_init(&disks[0], VIRTIO0))
+    panic("could not find virtio disk");
+  disk_init(&disks[1], VIRTIO1);
+
+  // plic.c and trap.c arrange for interrupts from
+  // VIRTIO0_IRQ and VIRTIO1_IRQ.
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// Size of disk n in bytes, or 0 if there is no such disk.
+uint64
+virtio_disk_size(int n)
+{
+  struct disk *d = &disks[n];
+
+  if(!d->present)
+    return 0;
+  // the virtio-blk config space starts with the
+  // capacity, in 512-byte sectors.
+  return (*R(d, VIRTIO_MMIO_CONFIG) |
+          (uint64)*R(d, VIRTIO_MMIO_CONFIG + 4) << 32) * 512;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *d)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(d->free[i]){
+      d->free[i] = 0;
       return i;
     }
   }
@@ -127,51 +167,53 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *d, int i)
 {
   if(i >= NUM)
     panic("virtio_disk_intr 1");
-  if(disk.free[i])
+  if(d->free[i])
     panic("virtio_disk_intr 2");
-  disk.desc[i].addr = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  d->desc[i].addr = 0;
+  d->free[i] = 1;
+  wakeup(&d->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *d, int i)
 {
   while(1){
-    free_desc(i);
-    if(disk.desc[i].flags & VRING_DESC_F_NEXT)
-      i = disk.desc[i].next;
+    free_desc(d, i);
+    if(d->desc[i].flags & VRING_DESC_F_NEXT)
+      i = d->desc[i].next;
     else
       break;
   }
 }
 
 static int
-alloc3_desc(int *idx)
+alloc3_desc(struct disk *d, int *idx)
 {
   for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+    idx[i] = alloc_desc(d);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(d, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Start a read or write of the len bytes at physical address
+// pa from or to disk d, starting at sector, without waiting for
+// the device. b, if not 0, is the buffer of a read started by
+// virtio_disk_start(), which virtio_disk_intr() completes.
+// Caller must hold d->vdisk_lock.
+// Returns the index of the request's first descriptor.
+static int
+disk_start(struct disk *d, uint64 sector, uint64 pa, uint len, int write, struct buf *b)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
   // the spec says that legacy block operations use three
   // descriptors: one for type/reserved/sector, one for
   // the data, one for a 1-byte status result.
@@ -179,92 +221,165 @@ virtio_disk_rw(struct buf *b, int write)
   // allocate the three descriptors.
   int idx[3];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc3_desc(d, idx) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    sleep(&d->free[0], &d->vdisk_lock);
   }
   
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &d->ops[idx[0]];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  d->desc[idx[0]].addr = (uint64) buf0;
+  d->desc[idx[0]].len = sizeof(*buf0);
+  d->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  d->desc[idx[0]].next = idx[1];
+
+  d->desc[idx[1]].addr = pa;
+  d->desc[idx[1]].len = len;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    d->desc[idx[1]].flags = 0; // device reads the data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    d->desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes the data
+  d->desc[idx[1]].flags |= VRING_DESC_F_NEXT;
+  d->desc[idx[1]].next = idx[2];
 
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  d->info[idx[0]].status = 0;
+  d->desc[idx[2]].addr = (uint64) &d->info[idx[0]].status;
+  d->desc[idx[2]].len = 1;
+  d->desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d->desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // for virtio_disk_intr().
+  d->info[idx[0]].b = b;
+  d->info[idx[0]].busy = 1;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
   // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
+  d->avail[2 + (d->avail[1] % NUM)] = idx[0];
   __sync_synchronize();
-  disk.avail[1] = disk.avail[1] + 1;
+  d->avail[1] = d->avail[1] + 1;
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+
+  return idx[0];
+}
+
+// Read or write the len bytes at physical address pa
+// from or to disk d, starting at sector, and wait for
+// the device to finish.
+static void
+disk_rw(struct disk *d, uint64 sector, uint64 pa, uint len, int write)
+{
+  int id;
+
+  acquire(&d->vdisk_lock);
+
+  id = disk_start(d, sector, pa, len, write, 0);
 
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(d->info[id].busy) {
+    sleep(&d->info[id], &d->vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  free_chain(d, id);
+
+  release(&d->vdisk_lock);
+}
 
-  release(&disk.vdisk_lock);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  b->disk = 1;
+  disk_rw(&disks[0], b->blockno * (BSIZE / 512), (uint64)b->data, BSIZE, write);
+  b->disk = 0;
 }
 
+// Start reading b's block, for readahead, and return without
+// waiting. b->disk stays set until the data is in; then
+// virtio_disk_intr() sets b->valid. b need not stay locked,
+// nor referenced, meanwhile; see virtio_disk_wait().
 void
-virtio_disk_intr()
+virtio_disk_start(struct buf *b)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = &disks[0];
 
-  while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-    int id = disk.used->elems[disk.used_idx].id;
+  acquire(&d->vdisk_lock);
+  b->disk = 1;
+  disk_start(d, b->blockno * (BSIZE / 512), (uint64)b->data, BSIZE, 0, b);
+  release(&d->vdisk_lock);
+}
+
+// Wait for a read started by virtio_disk_start() to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  struct disk *d = &disks[0];
+
+  acquire(&d->vdisk_lock);
+  while(b->disk)
+    sleep(b, &d->vdisk_lock);
+  release(&d->vdisk_lock);
+}
 
-    if(disk.info[id].status != 0)
+// Read nblocks file system blocks, from blockno on, into
+// the memory at pa, bypassing the buffer cache; see pcfill().
+void
+virtio_disk_readblocks(uint blockno, void *pa, uint nblocks)
+{
+  disk_rw(&disks[0], (uint64)blockno * (BSIZE / 512), (uint64)pa, nblocks * BSIZE, 0);
+}
+
+// Read or write the page at pa from or to page number pn
+// of disk n.
+void
+virtio_disk_rwpage(int n, uint64 pn, void *pa, int write)
+{
+  if(!disks[n].present)
+    panic("virtio_disk_rwpage");
+  disk_rw(&disks[n], pn * (PGSIZE / 512), (uint64)pa, PGSIZE, write);
+}
+
+void
+virtio_disk_intr(int n)
+{
+  struct disk *d = &disks[n];
+
+  acquire(&d->vdisk_lock);
+
+  while((d->used_idx % NUM) != (d->used->id % NUM)){
+    int id = d->used->elems[d->used_idx].id;
+
+    if(d->info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    d->info[id].busy = 0;   // disk is done with the request
+    if(d->info[id].b){
+      // no one waits on the request itself.
+      struct buf *b = d->info[id].b;
+      d->info[id].b = 0;
+      b->valid = 1;
+      b->disk = 0;
+      wakeup(b);
+      free_chain(d, id);
+    } else {
+      wakeup(&d->info[id]);
+    }
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
+    d->used_idx = (d->used_idx + 1) % NUM;
   }
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
-  release(&disk.vdisk_lock);
+  release(&d->vdisk_lock);
 }
@@ -3,48 +3,85 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
+#include "wordops.h"
 #include "fs.h"
+#include "sysinfo.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// highest ASID the hardware implements, or 0 if none.
+uint asidmax;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
+// kalloc_pages() order of a 2MB megapage.
+#define SUPERPGORDER 9
+
+// number of megapage mappings in user page tables.
+int nsuperpage;
+
+// number of pages holding page tables.
+int nptpage;
+
+// Allocate a zeroed page-table page.
+static pagetable_t
+ptalloc(void)
+{
+  pagetable_t pt;
+
+  if((pt = (pagetable_t)kalloc_zeroed()) != 0)
+    __sync_fetch_and_add(&nptpage, 1);
+  return pt;
+}
+
+static void
+ptfree(pagetable_t pt)
+{
+  __sync_fetch_and_sub(&nptpage, 1);
+  kfree((void*)pt);
+}
+
 extern char trampoline[]; // trampoline.S
 
 /*
  * create a direct-map page table for the kernel.
+ * kvmmap() uses 2-megabyte megapages wherever it can.
+ * everything at or above MAXUVA is also mapped into each
+ * process's page table (see uvmkmap()), and so is global.
  */
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  kernel_pagetable = ptalloc();
 
   // uart registers
-  kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
-  // virtio mmio disk interface
-  kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  // virtio mmio disk interfaces
+  kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_G);
+  kvmmap(VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W | PTE_G);
 
-  // CLINT
+  // CLINT; only here, since it lies in user space.
   kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W | PTE_G);
 
   // map kernel text executable and read-only.
-  kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
-  kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -52,13 +89,28 @@ kvminit()
 void
 kvminithart()
 {
+  // find out how many ASID bits satp implements by
+  // writing all ones to the field and reading it back.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Switch back to the kernel's page table, from a
+// process's. No flush is needed: the kernel page
+// table has ASID 0, which no process uses.
+void
+kvmswitch()
+{
+  w_satp(MAKE_SATP(kernel_pagetable));
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages. If va lies in a
+// megapage, return the level-1 leaf PTE that maps it.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -77,17 +129,71 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = ptalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Like walk() without alloc, but also return the size of
+// the page that the PTE maps in *sz.
+pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, uint64 *sz)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    panic("walkleaf");
+
+  pte = &pagetable[PX(2, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  pagetable = (pagetable_t)PTE2PA(*pte);
+  pte = &pagetable[PX(1, va)];
+  if((*pte & PTE_V) == 0)
+    return 0;
+  if(PTE_LEAF(*pte)){
+    *sz = SUPERPGSIZE;
+    return pte;
+  }
+  pagetable = (pagetable_t)PTE2PA(*pte);
+  *sz = PGSIZE;
+  return &pagetable[PX(0, va)];
+}
+
+// Create a level-1 leaf PTE mapping the megapage at va
+// to physical address pa. Both must be SUPERPGSIZE-aligned.
+// Returns 0 on success, -1 if a page-table page couldn't
+// be allocated.
+int
+mapsuperpage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  if((va % SUPERPGSIZE) != 0 || (pa % SUPERPGSIZE) != 0)
+    panic("mapsuperpage: not aligned");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pagetable = ptalloc()) == 0)
+      return -1;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  pte = &pagetable[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("mapsuperpage: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -95,50 +201,64 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  uint64 pa, sz;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &sz);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + PGROUNDDOWN(va % sz);
   return pa;
 }
 
 // add a mapping to the kernel page table.
+// uses a megapage for each megapage-aligned 2MB
+// of the range, and 4096-byte pages for the rest.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, end, n;
+
+  end = va + sz;
+  for(a = va; a < end; a += n, pa += n){
+    if((a % SUPERPGSIZE) == 0 && (pa % SUPERPGSIZE) == 0 && end - a >= SUPERPGSIZE){
+      n = SUPERPGSIZE;
+      if(mapsuperpage(kernel_pagetable, a, pa, perm) != 0)
+        panic("kvmmap");
+    } else {
+      // 4096-byte pages up to the next megapage boundary.
+      n = SUPERPGROUNDUP(a + 1) - a;
+      if(n > end - a)
+        n = end - a;
+      if(mappages(kernel_pagetable, a, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+  }
 }
 
 // translate a kernel virtual address to
 // a physical address. only needed for
 // addresses on the stack.
-// assumes va is page aligned.
 uint64
 kvmpa(uint64 va)
 {
-  uint64 off = va % PGSIZE;
   pte_t *pte;
-  uint64 pa;
+  uint64 sz;
   
-  pte = walk(kernel_pagetable, va, 0);
+  pte = walkleaf(kernel_pagetable, va, &sz);
   if(pte == 0)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
-  pa = PTE2PA(*pte);
-  return pa+off;
+  return PTE2PA(*pte) + (va % sz);
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -167,31 +287,134 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Replace the user megapage mapping at va with a level-0
+// page table whose 512 PTEs map the same memory.
+// Returns 0 on success, -1 if out of memory.
+static int
+splitsuperpage(pagetable_t pagetable, uint64 va)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  uint64 pa, sz;
+  uint flags;
+
+  pte = walkleaf(pagetable, va, &sz);
+  if(pte == 0 || sz != SUPERPGSIZE)
+    panic("splitsuperpage");
+  if((pt = ptalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte);
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  __sync_fetch_and_sub(&nsuperpage, 1);
+  return 0;
+}
+
+// Back the megapage-aligned user range at va with a megapage
+// of zeroed memory. Returns 0 on success, -1 if no 2MB block
+// of physical memory is free.
+static int
+uvmsuperalloc(pagetable_t pagetable, uint64 va, int perm)
+{
+  char *mem;
+
+  if((mem = kalloc_pages(SUPERPGORDER)) == 0)
+    return -1;
+  pagezero(mem, SUPERPGSIZE);
+  if(mapsuperpage(pagetable, va, (uint64)mem, perm) != 0){
+    kfree_pages(mem, SUPERPGORDER);
+    return -1;
+  }
+  __sync_fetch_and_add(&nsuperpage, 1);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched, and so never
+// allocated (see vmfault()), are skipped. A megapage that is
+// only partly unmapped is split into pages first.
 // Optionally free the physical memory.
-void
+// Returns the number of pages unmapped.
+uint64
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, sz, n;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+  n = 0;
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += sz){
+    if((pte = walkleaf(pagetable, a, &sz)) == 0){
+      // no page table for this megapage range.
+      sz = SUPERPGROUNDUP(a + 1) - a;
+      continue;
+    }
+    if((*pte & PTE_V) == 0){
+      // e.g. a guard page, or a page in swap.
+      if((*pte & PTE_SWAP) && do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(sz == SUPERPGSIZE && ((a % SUPERPGSIZE) != 0 || end - a < SUPERPGSIZE)){
+      if(splitsuperpage(pagetable, a) == 0){
+        sz = 0;   // look again, now at the page.
+        continue;
+      }
+      if(!do_free)
+        panic("uvmunmap: split");
+      // no memory for a page table. keep the megapage
+      // mapped, but zero the part being unmapped, so it
+      // reads as fresh memory if the process grows again.
+      // that would also zero a copy-on-write sharer's
+      // memory; callers split shared megapages first
+      // (see uvmsplitshared()).
+      if(krefcount((void*)PTE2PA(*pte)) != 1)
+        panic("uvmunmap: shared megapage");
+      sz = SUPERPGROUNDUP(a + 1) - a;
+      if(sz > end - a)
+        sz = end - a;
+      memset((char*)PTE2PA(*pte) + (a % SUPERPGSIZE), 0, sz);
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      for(uint64 off = 0; off < sz; off += PGSIZE)
+        kfree((void*)(pa + off));
     }
+    if(sz == SUPERPGSIZE)
+      __sync_fetch_and_sub(&nsuperpage, 1);
     *pte = 0;
+    n += sz / PGSIZE;
   }
+  return n;
+}
+
+// Split the megapage mapping va, if va is inside it rather than
+// at its start, and it is shared copy-on-write with another
+// process; so that uvmunmap() of a range that starts or ends at
+// va never has to zero a shared megapage in place.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplitshared(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 sz;
+
+  if((va % SUPERPGSIZE) == 0 || va >= MAXUVA)
+    return 0;
+  if((pte = walkleaf(pagetable, va, &sz)) == 0 || sz != SUPERPGSIZE)
+    return 0;
+  if((*pte & PTE_V) == 0 || krefcount((void*)PTE2PA(*pte)) == 1)
+    return 0;
+  return splitsuperpage(pagetable, va);
 }
 
 // create an empty user page table.
@@ -200,13 +423,46 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
-  if(pagetable == 0)
-    return 0;
-  memset(pagetable, 0, PGSIZE);
+  pagetable = ptalloc();
   return pagetable;
 }
 
+// Map the kernel into user page table pagetable, above
+// MAXUVA, by sharing the kernel page table's lower-level
+// tables for RAM and for the devices.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmkmap(pagetable_t pagetable)
+{
+  pagetable_t l1, kl1;
+
+  if((l1 = ptalloc()) == 0)
+    return -1;
+  pagetable[0] = PA2PTE(l1) | PTE_V;
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = kl1[i];
+  for(int i = 1; i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = kernel_pagetable[i];
+  return 0;
+}
+
+// Undo uvmkmap(), so that uvmfree() doesn't
+// free the kernel's page-table pages.
+void
+uvmkunmap(pagetable_t pagetable)
+{
+  pagetable_t l1;
+
+  for(int i = 1; i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = 0;
+  if(pagetable[0] & PTE_V){
+    l1 = (pagetable_t)PTE2PA(pagetable[0]);
+    for(int i = PX(1, MAXUVA); i < 512; i++)
+      l1[i] = 0;
+  }
+}
+
 // Load the user initcode into address 0 of pagetable,
 // for the very first process.
 // sz must be less than a page.
@@ -217,31 +473,38 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Uses megapages for aligned 2MB ranges with nothing mapped yet.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   char *mem;
-  uint64 a;
+  uint64 a, sz;
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUVA)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if((a % SUPERPGSIZE) == 0 && newsz - a >= SUPERPGSIZE &&
+       walkleaf(pagetable, a, &sz) == 0 &&
+       uvmsuperalloc(pagetable, a, PTE_W|PTE_X|PTE_R|PTE_U) == 0){
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -286,7 +549,7 @@ freewalk(pagetable_t pagetable)
       panic("freewalk: leaf");
     }
   }
-  kfree((void*)pagetable);
+  ptfree(pagetable);
 }
 
 // Free user memory pages,
@@ -294,48 +557,226 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  // a megapage may extend past sz; see uvmunmap().
   if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+    uvmunmap(pagetable, 0, SUPERPGROUNDUP(sz)/PGSIZE, 1);
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table, but not the physical
+// memory: writable pages become read-only
+// copy-on-write pages in both parent and child.
+// Megapages stay megapages until written.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 1);
+}
+
+// Like uvmcopy(), for the page-aligned range [va, end).
+// If cow is 0, writable pages stay writable, so that
+// parent and child really share them.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int cow)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, n;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = va; i < end; i += n){
+    if((pte = walkleaf(old, i, &n)) == 0){
+      n = SUPERPGROUNDUP(i + 1) - i;   // never touched
+      continue;
+    }
+    if((*pte & PTE_V) == 0){
+      if(*pte != 0){
+        // not memory, but a marker such as a guard page.
+        pte_t *npte;
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        if((*pte & PTE_SWAP) && swapdup(PTE2SLOT(*pte)) < 0)
+          goto err;
+        *npte = *pte;
+      }
+      continue;
+    }
+    if(cow && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(n == SUPERPGSIZE){
+      if(mapsuperpage(new, i, pa, flags) != 0)
+        goto err;
+      __sync_fetch_and_add(&nsuperpage, 1);
+    } else if(mappages(new, i, PGSIZE, pa, flags) != 0){
       goto err;
     }
+    for(uint64 off = 0; off < n; off += PGSIZE)
+      kref((void*)(pa + off));
   }
+  // the parent's stale writable TLB entries are flushed
+  // when it next returns to user space.
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
+// Handle a page fault by process p at va; see vmfault().
+// A page below p->sz that has no PTE yet was grown by sbrk()
+// but never touched; give it a zeroed page, or a whole zeroed
+// megapage if the aligned 2MB around va is untouched and below
+// p->sz. A page of a memory-mapped file, or of the program's
+// segments, is read in by vmafill(), and a swapped-out page
+// by swapin(). A write to a copy-on-write page gets its own
+// writable copy, or just becomes writable if no one else shares
+// the page; a copy-on-write megapage is split first.
+// Flushes p's stale TLB entries for the page.
+// Returns 0 if the fault was resolved, FAULT_NOMEM if memory
+// is exhausted, or -1 if the access is illegal.
+static int
+vmfault1(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  uint64 pa, sz;
+  uint flags;
+  char *mem;
+  struct vma *v = 0;
+
+  if(va >= MAXUVA)
+    return -1;
+  if((v = vmalookup(p, va)) == 0 && va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walkleaf(p->pagetable, va, &sz);
+  if(pte && (*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP)
+    return swapin(p, pte);
+  if(v && (pte == 0 || *pte == 0))
+    return vmafill(p, v, va);
+  // a megapage mustn't cover the program's segments.
+  if(pte == 0 && SUPERPGROUNDDOWN(va) + SUPERPGSIZE <= p->sz &&
+     vmaoverlap(p, SUPERPGROUNDDOWN(va), SUPERPGROUNDDOWN(va) + SUPERPGSIZE) == 0 &&
+     uvmsuperalloc(p->pagetable, SUPERPGROUNDDOWN(va), PTE_W|PTE_X|PTE_R|PTE_U) == 0){
+    p->rss += SUPERPGSIZE / PGSIZE;
+    proc_tlbflush(p);
+    return 0;
+  }
+  if(pte == 0 || *pte == 0){
+    // demand-zero page.
+    if((mem = kalloc_zeroed()) == 0)
+      return FAULT_NOMEM;
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      kfree(mem);
+      return FAULT_NOMEM;
+    }
+    p->rss++;
+    proc_tlbflush(p);
+    return 0;
+  }
+
+  if(!write || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  if(sz == SUPERPGSIZE){
+    // copy-on-write works a page at a time.
+    if(splitsuperpage(p->pagetable, va) < 0)
+      return FAULT_NOMEM;
+    pte = walk(p->pagetable, va, 0);
+  }
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcount((void*)pa) == 1){
+    // the other sharers are gone.
+    *pte = PA2PTE(pa) | flags;
+    proc_tlbflush(p);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return FAULT_NOMEM;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  proc_tlbflush(p);
+  return 0;
+}
+
+// Handle a page fault by process p at va, which must be the
+// current process. If memory runs out, swap out one of p's
+// pages and try again.
+// Returns 0 if the fault was resolved, -1 if the access is
+// illegal or memory is exhausted.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  int r;
+
+  while((r = vmfault1(p, va, write)) == FAULT_NOMEM)
+    if(swapout(p) < 0)
+      return -1;
+  return r;
+}
+
+// Bring in the pages of p in [va, va+len) that a fault would
+// have to sleep for, those of mapped files and those in swap,
+// for a caller that is about to copy to or from them while
+// holding a spinlock or an inode lock. p must be the current
+// process.
+// Failures are left for the copy to find.
+void
+uvmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  uint64 a, sz;
+  pte_t *pte;
+
+  vmaprefault(p, va, len);
+  if(va >= p->sz)
+    return;
+  if(len > p->sz - va)
+    len = p->sz - va;
+  for(a = PGROUNDDOWN(va); a < va + len; a += sz){
+    if((pte = walkleaf(p->pagetable, a, &sz)) == 0){
+      sz = SUPERPGROUNDUP(a + 1) - a;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP)
+      vmfault(p, a, 0);
+  }
+}
+
+// Report page-table and megapage counts for sysinfo().
+void
+vminfo(struct sysinfo *info)
+{
+  info->ptpages = nptpage;
+  info->superpages = nsuperpage;
+}
+
+// uaccess.S
+extern int uaccess_copy(void *dst, void *src, uint64 n);
+extern int uaccess_copystr(char *dst, char *src, uint64 max);
+
+// Can the kernel reach user memory of pagetable directly?
+// True if it is the current process's, since this CPU is
+// then running on it.
+static int
+uvmactive(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+  return p != 0 && p->pagetable == pagetable;
+}
+
+// turn the page at va into a guard page: free its
+// memory and leave an invalid PTE marked PTE_GUARD,
+// so that vmfault() won't allocate it again.
+// (a valid PTE without PTE_U would not do, since the
+// kernel reaches user memory directly; see copyout().)
 // used by exec for the user stack guard page.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
@@ -343,18 +784,32 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte_t *pte;
   
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_FLAGS(*pte) == PTE_V)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  kfree((void*)PTE2PA(*pte));
+  *pte = PTE_GUARD;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// If it is the current process's page table, store directly to
+// user memory, letting kerneltrap() handle page faults; otherwise
+// look up each page in software.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r;
+
+  if(uvmactive(pagetable)){
+    if(dstva >= MAXUVA || len > MAXUVA - dstva)
+      return -1;
+    w_sstatus(r_sstatus() | SSTATUS_SUM);
+    r = uaccess_copy((void*)dstva, src, len);
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+    return r;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
@@ -380,6 +835,16 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  int r;
+
+  if(uvmactive(pagetable)){
+    if(srcva >= MAXUVA || len > MAXUVA - srcva)
+      return -1;
+    w_sstatus(r_sstatus() | SSTATUS_SUM);
+    r = uaccess_copy(dst, (void*)srcva, len);
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+    return r;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
@@ -407,6 +872,19 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  int r;
+  char *p;
+
+  if(uvmactive(pagetable)){
+    if(srcva >= MAXUVA)
+      return -1;
+    if(max > MAXUVA - srcva)
+      max = MAXUVA - srcva;
+    w_sstatus(r_sstatus() | SSTATUS_SUM);
+    r = uaccess_copystr(dst, (char*)srcva, max);
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+    return r;
+  }
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
@@ -417,19 +895,12 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     if(n > max)
       n = max;
 
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    p = (char *) (pa0 + (srcva - va0));
+    if(wcopystr(dst, p, n) < n){
+      got_null = 1;
+    } else {
+      dst += n;
+      max -= n;
     }
 
     srcva = va0 + PGSIZE;
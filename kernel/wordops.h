@@ -0,0 +1,176 @@
+// Word-at-a-time memory and string loops, shared by the
+// kernel (kernel/string.c, copyinstr()) and user space
+// (user/ulib.c). Include after types.h.
+//
+// The loops move 8-byte words when source and destination
+// have the same alignment modulo 8, after byte steps up to
+// the first aligned address; RISC-V may trap on misaligned
+// word accesses, so otherwise they fall back to bytes.
+// A word load never crosses an aligned 8-byte boundary, so
+// the string loops, which may read a few bytes past the
+// terminating '\0', never touch another page.
+
+#define WSIZE   8
+#define WMASK   (WSIZE-1)
+#define WONES   0x0101010101010101UL
+#define WHIGHS  0x8080808080808080UL
+
+// non-zero if some byte of w is zero.
+#define WHASZERO(w)  (((w) - WONES) & ~(w) & WHIGHS)
+
+static inline void
+wmemset(void *dst, int c, uint64 n)
+{
+  uchar *d = dst;
+  uint64 w, *wd;
+
+  while(n > 0 && ((uint64)d & WMASK)){
+    *d++ = c;
+    n--;
+  }
+  w = (uchar)c * WONES;
+  wd = (uint64*)d;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4){
+    wd[0] = w;
+    wd[1] = w;
+    wd[2] = w;
+    wd[3] = w;
+  }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wd++ = w;
+  d = (uchar*)wd;
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static inline void
+wmemmove(void *dst, const void *src, uint64 n)
+{
+  uchar *d = dst;
+  const uchar *s = src;
+  uint64 *wd;
+  const uint64 *ws;
+
+  if(d == s || n == 0)
+    return;
+
+  if(s < d && s + n > d){
+    // overlapping, with dst above src: copy backwards.
+    d += n;
+    s += n;
+    if((((uint64)d ^ (uint64)s) & WMASK) == 0){
+      while(n > 0 && ((uint64)d & WMASK)){
+        *--d = *--s;
+        n--;
+      }
+      wd = (uint64*)d;
+      ws = (const uint64*)s;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        wd -= 4;
+        ws -= 4;
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      d = (uchar*)wd;
+      s = (const uchar*)ws;
+    }
+    while(n-- > 0)
+      *--d = *--s;
+    return;
+  }
+
+  if((((uint64)d ^ (uint64)s) & WMASK) == 0){
+    while(n > 0 && ((uint64)d & WMASK)){
+      *d++ = *s++;
+      n--;
+    }
+    wd = (uint64*)d;
+    ws = (const uint64*)s;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wd += 4, ws += 4){
+      wd[0] = ws[0];
+      wd[1] = ws[1];
+      wd[2] = ws[2];
+      wd[3] = ws[3];
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = *ws++;
+    d = (uchar*)wd;
+    s = (const uchar*)ws;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static inline int
+wmemcmp(const void *v1, const void *v2, uint64 n)
+{
+  const uchar *s1 = v1, *s2 = v2;
+  const uint64 *w1, *w2;
+
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0){
+    while(n > 0 && ((uint64)s1 & WMASK)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the byte loop below finds
+    // the first difference within a word.
+    w1 = (const uint64*)s1;
+    w2 = (const uint64*)s2;
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    s1 = (const uchar*)w1;
+    s2 = (const uchar*)w2;
+  }
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+  return 0;
+}
+
+static inline uint64
+wstrlen(const char *s)
+{
+  const char *p = s;
+  const uint64 *w;
+
+  for(; (uint64)p & WMASK; p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const uint64*)p; !WHASZERO(*w); w++)
+    ;
+  for(p = (const char*)w; *p; p++)
+    ;
+  return p - s;
+}
+
+// Copy the string at src to dst, including its '\0',
+// but at most n bytes. Returns the length of the string,
+// or n if there was no '\0' in the first n bytes.
+static inline uint64
+wcopystr(char *dst, const char *src, uint64 n)
+{
+  uint64 i = 0;
+  const uint64 *ws;
+  uint64 *wd;
+
+  if((((uint64)dst ^ (uint64)src) & WMASK) == 0){
+    for(; i < n && ((uint64)(src+i) & WMASK); i++)
+      if((dst[i] = src[i]) == 0)
+        return i;
+    ws = (const uint64*)(src+i);
+    wd = (uint64*)(dst+i);
+    for(; n - i >= WSIZE && !WHASZERO(*ws); i += WSIZE)
+      *wd++ = *ws++;
+  }
+  for(; i < n; i++)
+    if((dst[i] = src[i]) == 0)
+      return i;
+  return n;
+}
@@ -0,0 +1,208 @@
+//
+// tests for the buffer cache: many processes, each with
+// its own file of more blocks than the cache starts with.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NBLOCK  (NBUF + 20)   // blocks in each child's file
+
+char buf[BSIZE];
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("bcachetest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// fill buf with block i of file n.
+void
+fillblock(int n, int i)
+{
+  for(int j = 0; j < BSIZE; j++)
+    buf[j] = 'a' + (n * 7 + i * 3 + j) % 26;
+}
+
+void
+child(int n)
+{
+  char name[] = "bc.0";
+  char want[BSIZE];
+  int fd;
+
+  name[3] = '0' + n;
+  unlink(name);
+  if((fd = open(name, O_CREATE | O_WRONLY)) < 0)
+    exit(1);
+  for(int i = 0; i < NBLOCK; i++){
+    fillblock(n, i);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      exit(2);
+  }
+  close(fd);
+
+  // read it back twice, while the other children's
+  // misses add and recycle buffers.
+  for(int pass = 0; pass < 2; pass++){
+    if((fd = open(name, O_RDONLY)) < 0)
+      exit(3);
+    for(int i = 0; i < NBLOCK; i++){
+      fillblock(n, i);
+      memmove(want, buf, BSIZE);
+      if(read(fd, buf, BSIZE) != BSIZE)
+        exit(4);
+      if(memcmp(buf, want, BSIZE) != 0)
+        exit(5);
+    }
+    close(fd);
+  }
+  unlink(name);
+  exit(0);
+}
+
+// the children's blocks hash to many buckets, and misses
+// move buffers between buckets while other children look
+// blocks up.
+void
+parallel_test(void)
+{
+  int pid, xstatus;
+
+  testname = "parallel";
+  for(int n = 0; n < NCHILD; n++){
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0)
+      child(n);
+  }
+  for(int n = 0; n < NCHILD; n++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("child exit status %d\n", xstatus);
+      err("child");
+    }
+  }
+  printf("bcachetest: %s OK\n", testname);
+}
+
+// the cache grows past NBUF to hold a file of more blocks,
+// and reading the file again then finds all of them.
+void
+grow_test(void)
+{
+  struct sysinfo before, after;
+  int fd;
+
+  testname = "grow";
+  unlink("bc.grow");
+  if((fd = open("bc.grow", O_CREATE | O_RDWR)) < 0)
+    err("open");
+  for(int i = 0; i < NBLOCK; i++){
+    fillblock(0, i);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write");
+  }
+  close(fd);
+
+  if(sysinfo(&before) < 0)
+    err("sysinfo");
+  if(before.nbuf <= NBUF)
+    err("cache did not grow");
+  if((fd = open("bc.grow", O_RDONLY)) < 0)
+    err("open");
+  for(int i = 0; i < NBLOCK; i++)
+    if(read(fd, buf, BSIZE) != BSIZE)
+      err("read");
+  close(fd);
+  if(sysinfo(&after) < 0)
+    err("sysinfo");
+  if(after.nbufmiss != before.nbufmiss){
+    printf("%d misses\n", after.nbufmiss - before.nbufmiss);
+    err("blocks fell out of the cache");
+  }
+  unlink("bc.grow");
+  printf("bcachetest: %s OK\n", testname);
+}
+
+// the byte at offset off of file 1 (see fillblock()).
+char
+fbyte(int off)
+{
+  return 'a' + (7 + (off / BSIZE) * 3 + off % BSIZE) % 26;
+}
+
+// read n bytes at offset off from fd, which must be there,
+// and check them.
+void
+checkread(int fd, int off, int n)
+{
+  if(read(fd, buf, n) != n)
+    err("read");
+  for(int j = 0; j < n; j++)
+    if(buf[j] != fbyte(off + j))
+      err("content");
+}
+
+// reads in odd-sized pieces see the file's contents while
+// readahead runs in front of them, and while two descriptors
+// take turns, which readahead sees as sequential only
+// now and then.
+void
+readahead_test(void)
+{
+  int fd, fd2, n, sz = NBLOCK*BSIZE;
+
+  testname = "readahead";
+  unlink("bc.ra");
+  if((fd = open("bc.ra", O_CREATE | O_WRONLY)) < 0)
+    err("open");
+  for(int i = 0; i < NBLOCK; i++){
+    fillblock(1, i);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write");
+  }
+  close(fd);
+
+  for(int step = 100; step <= 3*BSIZE; step *= 3){
+    if((fd = open("bc.ra", O_RDONLY)) < 0)
+      err("open");
+    for(int off = 0; off < sz; off += n){
+      n = step < sz - off ? step : sz - off;
+      if(n > BSIZE)
+        n = BSIZE;
+      checkread(fd, off, n);
+    }
+    close(fd);
+  }
+
+  if((fd = open("bc.ra", O_RDONLY)) < 0 || (fd2 = open("bc.ra", O_RDONLY)) < 0)
+    err("open");
+  for(int off = 0; off < sz; off += BSIZE){
+    checkread(fd, off, BSIZE/2);
+    checkread(fd2, off, BSIZE/2);
+    checkread(fd, off + BSIZE/2, BSIZE/2);
+    checkread(fd2, off + BSIZE/2, BSIZE/2);
+  }
+  close(fd);
+  close(fd2);
+  unlink("bc.ra");
+  printf("bcachetest: %s OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  parallel_test();
+  grow_test();
+  readahead_test();
+  printf("bcachetest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,288 @@
+//
+// tests for lazy, demand-zero sbrk.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define REGION_SZ (160 * 1024 * 1024)
+
+// reserve far more memory than the machine has, and
+// touch only a sparse subset of it.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char **)i != i){
+      printf("failed to read value from memory\n");
+      exit(1);
+    }
+  }
+
+  exit(0);
+}
+
+// untouched pages read as zero, also after being
+// freed by a negative sbrk() and grown again.
+void
+zero_fill(char *s)
+{
+  char *a;
+
+  a = sbrk(4 * PGSIZE);
+  for(int i = 0; i < 4 * PGSIZE; i++){
+    if(a[i] != 0){
+      printf("page not zero-filled\n");
+      exit(1);
+    }
+  }
+  a[PGSIZE] = 99;
+  sbrk(-3 * PGSIZE);
+  sbrk(3 * PGSIZE);
+  if(a[PGSIZE] != 0){
+    printf("shrunk page kept its contents\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+// pass untouched memory to system calls that
+// copy in and out of user space.
+void
+sparse_memory_unmap(char *s)
+{
+  char *prev_end;
+  int fd;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+
+  fd = open("lazyfile", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("open failed\n");
+    exit(1);
+  }
+  // copyin from an untouched page.
+  if(write(fd, prev_end + 10 * PGSIZE, 100) != 100){
+    printf("write from untouched memory failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("lazyfile", O_RDONLY);
+  if(fd < 0){
+    printf("open failed\n");
+    exit(1);
+  }
+  // copyout to an untouched page.
+  prev_end[20 * PGSIZE] = 1;
+  if(read(fd, prev_end + 20 * PGSIZE, 100) != 100){
+    printf("read into untouched memory failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("lazyfile");
+  if(prev_end[20 * PGSIZE] != 0){
+    printf("read the wrong data\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+// fork with a mostly untouched heap, and check that
+// the child sees the touched pages.
+void
+fork_sparse(char *s)
+{
+  char *a;
+  int pid, xstatus;
+
+  a = sbrk(REGION_SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  a[PGSIZE] = 'x';
+  a[REGION_SZ - 1] = 'y';
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(a[PGSIZE] != 'x' || a[REGION_SZ - 1] != 'y' || a[2 * PGSIZE] != 0)
+      exit(1);
+    a[3 * PGSIZE] = 'z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("child saw the wrong memory\n");
+    exit(1);
+  }
+  if(a[3 * PGSIZE] != 0){
+    printf("child wrote parent's memory\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+// a large heap is backed by megapages; shrinking it by less
+// than a megapage, and writing to it after fork(), split them.
+void
+superpages(char *s)
+{
+  char *a, *b;
+  int pid, xstatus;
+  int sz = 8 * 1024 * 1024;
+
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  for(b = a; b < a + sz; b += PGSIZE)
+    *(int*)b = (b - a) / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(b = a; b < a + sz; b += 2 * PGSIZE)
+      *(int*)b = -1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  sbrk(-(sz / 2 + 3 * PGSIZE));
+  for(b = a; b < a + sz / 2 - 3 * PGSIZE; b += PGSIZE){
+    if(*(int*)b != (b - a) / PGSIZE){
+      printf("wrong content at %p\n", b);
+      exit(1);
+    }
+  }
+  sbrk(sz / 2 + 3 * PGSIZE);
+  for(b = a + sz / 2 - 3 * PGSIZE; b < a + sz; b += PGSIZE){
+    if(*(int*)b != 0){
+      printf("regrown page at %p not zero\n", b);
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+// touching memory above the break, or the stack guard
+// page, must kill the process.
+void
+oob(char *s)
+{
+  char *addrs[2];
+  int pid, xstatus;
+
+  addrs[0] = sbrk(0) + 10 * PGSIZE;
+  addrs[1] = (char*)(PGROUNDDOWN((uint64)&pid) - PGSIZE);
+  for(int i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      *addrs[i] = 'a';
+      printf("%p was writable\n", addrs[i]);
+      exit(0);
+    }
+    wait(&xstatus);
+    if(xstatus != -1)
+      exit(1);
+  }
+  exit(0);
+}
+
+// run each test in its own process and report the result.
+int
+run(void f(char *), char *s)
+{
+  int pid;
+  int xstatus;
+
+  printf("running test %s\n", s);
+  if((pid = fork()) < 0){
+    printf("runtest: fork error\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("test %s: FAILED\n", s);
+    else
+      printf("test %s: OK\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *n = 0;
+  if(argc > 1)
+    n = argv[1];
+
+  struct test {
+    void (*f)(char *);
+    char *s;
+  } tests[] = {
+    { sparse_memory, "lazy alloc"},
+    { zero_fill, "lazy zero fill"},
+    { sparse_memory_unmap, "lazy copyin/copyout"},
+    { fork_sparse, "lazy fork"},
+    { superpages, "superpages"},
+    { oob, "out of bounds"},
+    { 0, 0},
+  };
+
+  printf("lazytests starting\n");
+
+  int fail = 0;
+  for(struct test *t = tests; t->s != 0; t++){
+    if((n == 0) || strcmp(t->s, n) == 0){
+      if(!run(t->f, t->s))
+        fail = 1;
+    }
+  }
+  if(fail){
+    printf("SOME TESTS FAILED\n");
+    exit(1);
+  } else {
+    printf("ALL TESTS PASSED\n");
+    exit(0);
+  }
+}
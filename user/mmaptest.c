@@ -0,0 +1,275 @@
+//
+// tests for mmap() and munmap().
+//
+
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define FILESZ (PGSIZE + PGSIZE/2)   // one and a half pages
+
+char buf[PGSIZE];
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// the byte at offset i of the test file.
+char
+fbyte(int i)
+{
+  return 'a' + i % 23;
+}
+
+// create the test file.
+void
+makefile(const char *f)
+{
+  int fd;
+
+  unlink(f);
+  fd = open(f, O_WRONLY | O_CREATE);
+  if(fd == -1)
+    err("open");
+  for(int i = 0; i < FILESZ; i++)
+    buf[i % PGSIZE] = fbyte(i);
+  if(write(fd, buf, PGSIZE) != PGSIZE ||
+     write(fd, buf, FILESZ - PGSIZE) != FILESZ - PGSIZE)
+    err("write");
+  if(close(fd) == -1)
+    err("close");
+}
+
+// check that p holds the file's contents, then zeros up
+// to the end of the second page.
+void
+checkmap(char *p)
+{
+  for(int i = 0; i < 2*PGSIZE; i++){
+    char want = i < FILESZ ? fbyte(i) : 0;
+    if(p[i] != want){
+      printf("mismatch at %d, wanted '%c', got '%c'\n", i, want, p[i]);
+      err("content");
+    }
+  }
+}
+
+// the file's contents, read with read().
+void
+checkfile(const char *f, int off, char c)
+{
+  int fd;
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  if(read(fd, buf, PGSIZE) != PGSIZE)
+    err("read");
+  if(buf[off] != c)
+    err("file content");
+  close(fd);
+}
+
+// a child that touches p must be killed.
+void
+checkgone(char *p)
+{
+  int pid, xstatus;
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    *(volatile char*)p;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    err("unmapped memory still readable");
+}
+
+void
+private_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "private";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);   // the mapping keeps the file open.
+  checkmap(p);
+  p[10] = 'Z';
+  if(munmap(p, 2*PGSIZE) == -1)
+    err("munmap");
+  checkfile(f, 10, fbyte(10));
+  checkgone(p);
+  printf("mmaptest: %s OK\n", testname);
+}
+
+void
+shared_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "shared";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  if(mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    err("writable shared mapping of a read-only file");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  checkmap(p);
+  p[10] = 'Z';
+  p[PGSIZE + 20] = 'Y';
+  if(munmap(p, PGSIZE) == -1)
+    err("munmap first page");
+  checkfile(f, 10, 'Z');
+  if(p[PGSIZE + 20] != 'Y')
+    err("second page lost its write");
+  checkgone(p);
+  if(munmap(p + PGSIZE, PGSIZE) == -1)
+    err("munmap second page");
+  checkgone(p + PGSIZE);
+
+  // the write back must not grow the file.
+  struct stat st;
+  if(stat(f, &st) < 0 || st.size != FILESZ)
+    err("file size changed");
+  printf("mmaptest: %s OK\n", testname);
+}
+
+// unmap a page out of the middle of a mapping.
+void
+hole_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "hole";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  if(munmap(p + PGSIZE, PGSIZE) == -1)
+    err("munmap");
+  if(p[0] != fbyte(0) || p[2*PGSIZE] != 0)
+    err("rest of mapping");
+  checkgone(p + PGSIZE);
+  if(munmap(p, PGSIZE) == -1 || munmap(p + 2*PGSIZE, PGSIZE) == -1)
+    err("munmap rest");
+  printf("mmaptest: %s OK\n", testname);
+}
+
+// system calls that copy to and from mapped memory.
+void
+copy_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd, fds[2];
+
+  testname = "copy";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    err("mmap");
+  close(fd);
+  // copyout() into a page that is not yet loaded.
+  makefile("mmap.src");
+  if((fd = open("mmap.src", O_RDONLY)) == -1)
+    err("open");
+  if(read(fd, p + PGSIZE, 100) != 100)
+    err("read into mapping");
+  if(p[PGSIZE] != fbyte(0) || p[PGSIZE + 100] != fbyte(PGSIZE + 100))
+    err("read content");
+  close(fd);
+  unlink("mmap.src");
+  // copyin() from a page that is not yet loaded, under
+  // the pipe's spinlock; pipewrite() loads it beforehand.
+  if(pipe(fds) < 0)
+    err("pipe");
+  if(write(fds[1], p + 5, 1) != 1 || read(fds[0], buf, 1) != 1 || buf[0] != fbyte(5))
+    err("write from mapping");
+  close(fds[0]);
+  close(fds[1]);
+  munmap(p, 2*PGSIZE);
+  printf("mmaptest: %s OK\n", testname);
+}
+
+void
+fork_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p1, *p2;
+  int fd, pid, xstatus;
+
+  testname = "fork";
+  makefile(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p1 = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  p2 = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p1 == (char*)-1 || p2 == (char*)-1)
+    err("mmap");
+  close(fd);
+  // load p1 before fork, but not p2.
+  if(p1[0] != fbyte(0))
+    err("content");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(p1[1] != fbyte(1) || p2[1] != fbyte(1))
+      exit(1);
+    p1[1] = 'S';
+    p2[1] = 'P';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child");
+  if(p1[1] != 'S')
+    err("child's shared write not seen");
+  if(p2[1] != fbyte(1))
+    err("child's private write seen");
+  printf("mmaptest: %s OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  private_test();
+  shared_test();
+  hole_test();
+  copy_test();
+  fork_test();
+  unlink("mmap.dur");
+  printf("mmaptest: all tests succeeded\n");
+  exit(0);
+}
@@ -12,6 +12,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXSPAWN 50  // commands in a line of input; see spawncmd()
 
 struct cmd {
   int type;
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,89 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd be run with spawn(), instead of fork() and exec()?
+// True if it is made of only commands, redirections and pipes.
+int
+canspawn(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    return canspawn(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return canspawn(pcmd->left) && canspawn(pcmd->right);
+  }
+  return 0;
+}
+
+// Start the commands in cmd, for which canspawn() is true,
+// with fds as their standard input, output and error, and
+// store their pids in pids[].
+// Returns the number of processes started, for the
+// caller to wait for.
+int
+spawncmd(struct cmd *cmd, int fds[3], int *pids)
+{
+  int n, m, fd, pid, p[2], sfds[3];
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    pids[0] = pid;
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    memmove(sfds, fds, sizeof(sfds));
+    sfds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, sfds, pids);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    // this runs in the shell itself, which mustn't die.
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    memmove(sfds, fds, sizeof(sfds));
+    sfds[1] = p[1];
+    n = spawncmd(pcmd->left, sfds, pids);
+    memmove(sfds, fds, sizeof(sfds));
+    sfds[0] = p[0];
+    m = spawncmd(pcmd->right, sfds, pids + n);
+    if(m == 0){
+      // nothing will ever read the pipe; don't leave the
+      // left side running. the caller still waits for it.
+      for(int i = 0; i < n; i++)
+        kill(pids[i]);
+    }
+    close(p[0]);
+    close(p[1]);
+    return n + m;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +230,10 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n;
+  int fds[3] = { 0, 1, 2 };
+  int pids[MAXSPAWN];
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +252,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(canspawn(cmd)){
+      // no need to copy the shell only to exec().
+      for(n = spawncmd(cmd, fds, pids); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -256,9 +353,44 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
 //PAGEBREAK!
 // Parsing
 
+// The shell parses commands itself, not in a child, so
+// a syntax error is reported and the command dropped.
+int syntaxerr;
+
+void
+syntax(char *s)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", s);
+  syntaxerr = 1;
+}
+
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
@@ -330,12 +462,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +516,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +544,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +572,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
+    if(argc >= MAXARGS){
+      syntax("too many args");
+      break;
+    }
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
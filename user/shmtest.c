@@ -0,0 +1,146 @@
+//
+// tests for shared-memory segments: shmat() and shmdt().
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("shmtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// a segment attached again by key, in a child,
+// maps the same memory; one inherited by fork() too.
+void
+basic_test(void)
+{
+  char *p, *q;
+  int pid, xstatus;
+
+  testname = "basic";
+  p = shmat(1, 2*PGSIZE);
+  if(p == (char*)-1)
+    err("shmat");
+  if(p[0] != 0 || p[2*PGSIZE - 1] != 0)
+    err("not zeroed");
+  p[0] = 'p';
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    q = shmat(1, PGSIZE);
+    if(q == (char*)-1 || q == p)
+      exit(1);
+    if(q[0] != 'p' || p[0] != 'p')
+      exit(2);
+    q[1] = 'c';
+    p[PGSIZE] = 'd';
+    if(shmdt(q) < 0)
+      exit(3);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child");
+  if(p[1] != 'c' || p[PGSIZE] != 'd')
+    err("child's writes not seen");
+
+  if(shmat(1, 3*PGSIZE) != (char*)-1)
+    err("attached more than the segment's size");
+  if(munmap(p, PGSIZE) != -1)
+    err("munmap of a segment");
+  if(shmdt(p + PGSIZE) != -1)
+    err("shmdt not at the start");
+  if(shmdt(p) < 0)
+    err("shmdt");
+  if(shmdt(p) != -1)
+    err("shmdt twice");
+  printf("shmtest: %s OK\n", testname);
+}
+
+// a producer fills a large segment; the consumer
+// sees it without any copying through the kernel.
+void
+pipeline_test(void)
+{
+  int sz = 1024 * 1024;
+  int fds[2], pid, xstatus;
+  uint *p;
+  char c;
+
+  testname = "pipeline";
+  if(pipe(fds) < 0)
+    err("pipe");
+  p = shmat(2, sz);
+  if(p == (uint*)-1)
+    err("shmat");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    for(int i = 0; i < sz / sizeof(uint); i++)
+      p[i] = i * 7;
+    write(fds[1], "x", 1);
+    exit(0);
+  }
+  if(read(fds[0], &c, 1) != 1)
+    err("read");
+  for(int i = 0; i < sz / sizeof(uint); i++)
+    if(p[i] != i * 7)
+      err("wrong data");
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child");
+  shmdt(p);
+  close(fds[0]);
+  close(fds[1]);
+  printf("shmtest: %s OK\n", testname);
+}
+
+// pages are freed after the last detach, and a new
+// segment with the same key starts out zeroed.
+void
+free_test(void)
+{
+  struct sysinfo before, after;
+  int sz = 64 * PGSIZE;
+  char *p;
+
+  testname = "free";
+  sysinfo(&before);
+  p = shmat(3, sz);
+  if(p == (char*)-1)
+    err("shmat");
+  for(int i = 0; i < sz; i += PGSIZE)
+    p[i] = 1;
+  shmdt(p);
+  sysinfo(&after);
+  // allow for a few page-table pages.
+  if(after.freemem + 4*PGSIZE < before.freemem)
+    err("pages not freed");
+
+  p = shmat(3, sz);
+  if(p == (char*)-1)
+    err("shmat");
+  if(p[0] != 0)
+    err("segment outlived its last detach");
+  shmdt(p);
+  printf("shmtest: %s OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  basic_test();
+  pipeline_test();
+  free_test();
+  printf("shmtest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,160 @@
+//
+// tests for swapping: more memory than the machine has.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("swaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// the word at offset i of page pn.
+uint64
+pword(uint64 pn, int i)
+{
+  return pn * 7919 + i;
+}
+
+void
+fill(uint64 *p, uint64 npages)
+{
+  for(uint64 pn = 0; pn < npages; pn++){
+    uint64 *w = p + pn*PGSIZE/sizeof(uint64);
+    w[0] = pword(pn, 0);
+    w[PGSIZE/sizeof(uint64) - 1] = pword(pn, 1);
+  }
+}
+
+int
+check(uint64 *p, uint64 npages)
+{
+  for(uint64 pn = 0; pn < npages; pn++){
+    uint64 *w = p + pn*PGSIZE/sizeof(uint64);
+    if(w[0] != pword(pn, 0) || w[PGSIZE/sizeof(uint64) - 1] != pword(pn, 1))
+      return -1;
+  }
+  return 0;
+}
+
+// touch a few megabytes more than is free, so that the
+// first pages must go to swap and come back intact. then
+// free the top half, and check that a child sees the pages
+// still in swap, and that its writes are its own.
+void
+overcommit_test(void)
+{
+  struct sysinfo info;
+  uint64 npages, *p;
+  int pid, xstatus;
+
+  testname = "overcommit";
+  if(sysinfo(&info) < 0)
+    err("sysinfo");
+  npages = info.freemem / PGSIZE + 1024;
+  p = (uint64*)sbrk(npages * PGSIZE);
+  if(p == (uint64*)-1)
+    err("sbrk");
+  fill(p, npages);
+  if(check(p, npages) < 0)
+    err("content");
+
+  sbrk(-(npages / 2) * PGSIZE);
+  npages -= npages / 2;
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(check(p, npages) < 0)
+      exit(1);
+    p[0] = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    err("child");
+  if(check(p, npages) < 0)
+    err("child's write seen");
+  sbrk(-npages * PGSIZE);
+  printf("swaptest: %s OK\n", testname);
+}
+
+// swapped-out pages are copied to and from by system calls,
+// including under a pipe's spinlock.
+void
+copy_test(void)
+{
+  struct sysinfo info;
+  uint64 npages, *p;
+  int fds[2];
+  uint64 w;
+
+  testname = "copy";
+  if(sysinfo(&info) < 0)
+    err("sysinfo");
+  npages = info.freemem / PGSIZE + 1024;
+  p = (uint64*)sbrk(npages * PGSIZE);
+  if(p == (uint64*)-1)
+    err("sbrk");
+  fill(p, npages);
+  if(pipe(fds) < 0)
+    err("pipe");
+  // p[0] was the first touched, so is likely in swap.
+  if(write(fds[1], p, sizeof(w)) != sizeof(w) || read(fds[0], &w, sizeof(w)) != sizeof(w))
+    err("pipe write");
+  if(w != pword(0, 0))
+    err("pipe content");
+  w = 42;
+  if(write(fds[1], &w, sizeof(w)) != sizeof(w) || read(fds[0], p + PGSIZE/sizeof(uint64), sizeof(w)) != sizeof(w))
+    err("pipe read");
+  if(p[PGSIZE/sizeof(uint64)] != 42)
+    err("read content");
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-npages * PGSIZE);
+  printf("swaptest: %s OK\n", testname);
+}
+
+// swap space is given back when a process exits.
+void
+free_test(void)
+{
+  int pid, xstatus;
+
+  testname = "free";
+  for(int i = 0; i < 3; i++){
+    if((pid = fork()) < 0)
+      err("fork");
+    if(pid == 0){
+      struct sysinfo info;
+      uint64 npages, *p;
+
+      sysinfo(&info);
+      npages = info.freemem / PGSIZE + 2048;
+      if((p = (uint64*)sbrk(npages * PGSIZE)) == (uint64*)-1)
+        exit(1);
+      fill(p, npages);
+      exit(check(p, npages) < 0 ? 2 : 0);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      err("child");
+  }
+  printf("swaptest: %s OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  overcommit_test();
+  copy_test();
+  free_test();
+  printf("swaptest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,142 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+//
+// tests for the sysinfo() system call.
+//
+
+#define NPAGES 16
+
+void
+sinfo(struct sysinfo *info)
+{
+  if(sysinfo(info) < 0){
+    printf("FAIL: sysinfo failed\n");
+    exit(1);
+  }
+}
+
+// touching sbrk()'d memory makes it resident; shrinking
+// the heap gives it back.
+void
+testmem()
+{
+  struct sysinfo before, during, after;
+  char *a;
+
+  printf("sysinfotest: testmem\n");
+  sinfo(&before);
+  if(before.freemem == 0){
+    printf("FAIL: no free memory\n");
+    exit(1);
+  }
+
+  a = sbrk(NPAGES * PGSIZE);
+  for(int i = 0; i < NPAGES; i++)
+    a[i * PGSIZE] = i;
+  sinfo(&during);
+  if(during.rss != before.rss + NPAGES){
+    printf("FAIL: rss %d, expected %d\n", during.rss, before.rss + NPAGES);
+    exit(1);
+  }
+  if(during.freemem > before.freemem - NPAGES * PGSIZE){
+    printf("FAIL: free memory did not drop by %d pages\n", NPAGES);
+    exit(1);
+  }
+
+  sbrk(-NPAGES * PGSIZE);
+  sinfo(&after);
+  if(after.rss != before.rss){
+    printf("FAIL: rss %d after sbrk, expected %d\n", after.rss, before.rss);
+    exit(1);
+  }
+  if(after.freemem < during.freemem + NPAGES * PGSIZE){
+    printf("FAIL: free memory did not come back\n");
+    exit(1);
+  }
+}
+
+// a forked child shows up as a process, with page tables
+// of its own.
+void
+testproc()
+{
+  struct sysinfo before, during, after;
+  int fds[2], pid, status;
+  char c;
+
+  printf("sysinfotest: testproc\n");
+  if(pipe(fds) < 0){
+    printf("FAIL: pipe failed\n");
+    exit(1);
+  }
+  sinfo(&before);
+  pid = fork();
+  if(pid < 0){
+    printf("FAIL: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  sinfo(&during);
+  if(during.nproc != before.nproc + 1){
+    printf("FAIL: nproc %d, expected %d\n", during.nproc, before.nproc + 1);
+    exit(1);
+  }
+  if(during.ptpages < before.ptpages + 3){
+    printf("FAIL: child page tables not counted\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  wait(&status);
+  sinfo(&after);
+  if(after.nproc != before.nproc){
+    printf("FAIL: nproc %d after wait, expected %d\n", after.nproc, before.nproc);
+    exit(1);
+  }
+  if(after.ptpages != before.ptpages){
+    printf("FAIL: ptpages %d after wait, expected %d\n", after.ptpages, before.ptpages);
+    exit(1);
+  }
+}
+
+void
+testbuf()
+{
+  struct sysinfo info;
+
+  printf("sysinfotest: testbuf\n");
+  sinfo(&info);
+  if(info.nbuf == 0 || info.nbufbusy > info.nbuf){
+    printf("FAIL: nbuf %d nbufbusy %d\n", info.nbuf, info.nbufbusy);
+    exit(1);
+  }
+}
+
+void
+testbad()
+{
+  printf("sysinfotest: testbad\n");
+  if(sysinfo((struct sysinfo *) 0xeaeb0b5b00002f5e) != -1){
+    printf("FAIL: sysinfo succeeded with bad argument\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("sysinfotest: start\n");
+  testmem();
+  testproc();
+  testbuf();
+  testbad();
+  printf("sysinfotest: OK\n");
+  exit(0);
+}
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct sysinfo;
 
 // system calls
 int fork(void);
@@ -23,6 +24,13 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int sysinfo(struct sysinfo*);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+void* shmat(int, int);
+int shmdt(void*);
+int spawn(const char*, char**, int*);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
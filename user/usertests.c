@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +681,175 @@ exectest(char *s)
 
 }
 
+// spawn() a child with its output redirected to a pipe,
+// and without the caller's other descriptors.
+void
+spawntest(char *s)
+{
+  int fds[3], p[2], pid, xstatus, n, cc;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char *bogusargv[] = { "nonexistent", 0 };
+  char buf[8];
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[0] = -1;
+  fds[1] = p[1];
+  fds[2] = 2;
+  pid = spawn("echo", echoargv, fds);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  // read to end of file, which comes only if the
+  // child's write end is the only other one.
+  close(p[1]);
+  n = 0;
+  while((cc = read(p[0], buf + n, sizeof(buf) - n)) > 0)
+    n += cc;
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nonexistent", bogusargv, 0) != -1){
+    printf("%s: spawn nonexistent succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: spawn failure left a child\n", s);
+    exit(1);
+  }
+}
+
+// a program's text is read-only, and writing to a
+// program's file drops the kernel's cached copy of it.
+void
+textwrite(char *s)
+{
+  int pid, xstatus, fd, fd1, n;
+  char *argv[] = { "textcopy", 0 };
+  int fds[3] = { -1, -1, -1 };
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(volatile int*)(uint64)textwrite = 10;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote to text\n", s);
+    exit(1);
+  }
+
+  // run a copy of echo, then spoil the copy.
+  fd = open("echo", O_RDONLY);
+  fd1 = open("textcopy", O_CREATE | O_WRONLY);
+  if(fd < 0 || fd1 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(fd1, buf, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(fd1);
+  if(spawn("textcopy", argv, fds) < 0 || wait(&xstatus) < 0 || xstatus != 0){
+    printf("%s: copy of echo failed\n", s);
+    exit(1);
+  }
+  fd = open("textcopy", O_WRONLY);
+  if(fd < 0 || write(fd, "junk", 4) != 4){
+    printf("%s: spoiling copy failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(spawn("textcopy", argv, fds) != -1){
+    printf("%s: ran spoiled copy\n", s);
+    exit(1);
+  }
+  unlink("textcopy");
+}
+
+// reads through the page cache see every write, whether
+// it overwrites cached data or extends the file.
+void
+pagecache(char *s)
+{
+  int fd, i, n;
+  char c, xs[200];
+
+  unlink("pcache");
+  fd = open("pcache", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*4096; i++){
+    c = 'a' + i % 26;
+    if(write(fd, &c, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(i == 4096){
+      // cache the first two pages, the second partly full.
+      close(fd);
+      fd = open("pcache", O_RDWR);
+      if(read(fd, buf, 4096) != 4096 || read(fd, buf, 4096) != 1){
+        printf("%s: read failed\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+
+  // overwrite across the first page boundary.
+  memset(xs, 'X', sizeof(xs));
+  fd = open("pcache", O_RDWR);
+  if(read(fd, buf, 4000) != 4000 || write(fd, xs, sizeof(xs)) != sizeof(xs)){
+    printf("%s: overwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("pcache", O_RDONLY);
+  n = 0;
+  for(i = 0; i < 3*4096; i += n){
+    if((n = read(fd, buf, sizeof(buf))) <= 0){
+      printf("%s: reread failed\n", s);
+      exit(1);
+    }
+    for(int j = 0; j < n; j++){
+      int k = i + j;
+      c = k >= 4000 && k < 4200 ? 'X' : 'a' + k % 26;
+      if(buf[j] != c){
+        printf("%s: stale byte at %d\n", s, k);
+        exit(1);
+      }
+    }
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: read past the end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pcache");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2526,6 +2696,104 @@ execout(char *s)
   exit(0);
 }
 
+// fsync() commits the log, including writes made by other
+// processes, does nothing if there is nothing to commit, and
+// rejects bad file descriptors.
+void
+fsynctest(char *s)
+{
+  struct sysinfo before, after;
+  int fd, pid, xstatus;
+
+  unlink("fsync");
+  fd = open("fsync", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create fsync\n", s);
+    exit(1);
+  }
+  sysinfo(&before);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(write(fd, "aaa", 3) != 3)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(fsync(fd) != 0 || sysinfo(&after) < 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  if(after.nlogcommit == before.nlogcommit){
+    printf("%s: child's write not committed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 10; i++){
+    sysinfo(&before);
+    if(write(fd, buf, BSIZE) != BSIZE || fsync(fd) != 0){
+      printf("%s: write or fsync failed\n", s);
+      exit(1);
+    }
+    sysinfo(&after);
+    if(after.nlogcommit == before.nlogcommit){
+      printf("%s: fsync did not commit\n", s);
+      exit(1);
+    }
+  }
+  // nothing left to commit.
+  sysinfo(&before);
+  if(fsync(fd) != 0){
+    printf("%s: fsync of a clean log failed\n", s);
+    exit(1);
+  }
+  sysinfo(&after);
+  if(after.nlogcommit != before.nlogcommit){
+    printf("%s: fsync of a clean log committed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1 || fsync(-1) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("fsync");
+}
+
+// a page of initialized data, which exec() leaves to be read
+// in at the first touch, and nothing but waitdata() touches.
+int waitstatus[PGSIZE/sizeof(int)] __attribute__((aligned(PGSIZE))) = { -1 };
+
+// wait() copies the exit status out under spinlocks, where a
+// fault can't read the page in; it must fault it in first.
+// run() forks each test from main()'s freshly exec()ed image,
+// so the page hasn't been touched yet.
+void
+waitdata(char *s)
+{
+  int pid;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(7);
+  if(wait(&waitstatus[0]) != pid){
+    printf("%s: wait into untouched data failed\n", s);
+    exit(1);
+  }
+  if(waitstatus[0] != 7){
+    printf("%s: wrong status %d\n", s, waitstatus[0]);
+    exit(1);
+  }
+}
+
 //
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
@@ -2639,6 +2907,8 @@ main(int argc, char *argv[])
     char *s;
   } tests[] = {
     {execout, "execout"},
+    {fsynctest, "fsynctest"},
+    {waitdata, "waitdata"},
     {copyin, "copyin"},
     {copyout, "copyout"},
     {copyinstr1, "copyinstr1"},
@@ -2666,6 +2936,9 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {textwrite, "textwrite"},
+    {pagecache, "pagecache"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
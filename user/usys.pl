@@ -36,3 +36,10 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("sysinfo");
+entry("mmap");
+entry("munmap");
+entry("shmat");
+entry("shmdt");
+entry("spawn");
+entry("fsync");